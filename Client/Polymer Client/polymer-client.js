@@ -11,6 +11,8 @@ var sendinput;
 var drawerPanel;
 
 var commandSwitch;
+var stateVersion = 0;
+var stateEpoch = 0;
 
 (function (document) {
 	'use strict';
@@ -63,11 +65,35 @@ function registerGlobals() {
 			if (parsed.auth === true) {
 				google_signin_status.profile = JSON.parse(parsed.profile);
 				google_signin_status.signedIn = true;
-				GetDeviceList();
+				SyncState();
 			}
 		},
 		"UPDATE" : function () {
-			GetDeviceList();
+			SyncState();
+		},
+		"SYNC" : function (parsed) {
+			stateVersion = parsed.version;
+			stateEpoch = parsed.epoch;
+			if (parsed.full) {
+				single_room.Devices = parsed.nodes.slice();
+				room_list.Rooms = parsed.rooms.slice();
+				updateSingleRoom();
+			} else {
+				parsed.nodes.forEach(updateNode);
+				parsed.removed.nodes.forEach(removeNode);
+				parsed.values.forEach(updateValue);
+				if (parsed.values.length > 0) {
+					single_room.Devices = single_room.Devices.slice();
+				}
+				parsed.rooms.forEach(updateRoom);
+				parsed.removed.rooms.forEach(removeRoom);
+			}
+			if (parsed.scenes) {
+				scene_list.Scenes = parsed.scenes.slice();
+			}
+			if (typeof parsed.athome != 'undefined') {
+				switchbutton.atHome = parsed.athome;
+			}
 		},
 		"ALIST" : function (parsed) {
 			single_room.Devices = parsed.nodes.slice();
@@ -77,14 +103,20 @@ function registerGlobals() {
 			updateSingleRoom();
 		},
 		"ROOM" : function (parsed) {
-			room_list.Rooms.forEach(function (roomItem) {
-				if (roomItem.Name === parsed.room.Name) {
-					roomItem.currentTemp = parsed.room.currentTemp;
-					roomItem.currentSetpoint = parsed.room.currentSetpoint;
-					updateSingleRoom();
-
-				}
-			});
+			updateRoom(parsed.room);
+		},
+		"CHANGES" : function (parsed) {
+			parsed.values.forEach(updateValue);
+			if (parsed.values.length > 0) {
+				single_room.Devices = single_room.Devices.slice();
+			}
+			parsed.rooms.forEach(updateRoom);
+			if (parsed.scenes) {
+				scene_list.Scenes = parsed.scenes.slice();
+			}
+			if (typeof parsed.athome != 'undefined') {
+				switchbutton.atHome = parsed.athome;
+			}
 		},
 		"SCENELIST" : function (parsed) {
 			scene_list.Scenes = parsed.scenes.slice();
@@ -150,11 +182,66 @@ function registerEventListeners() {
 	});
 }
 
-function GetDeviceList() {
-	websocketElement.send("ALIST");
-	websocketElement.send("ROOMLIST");
-	websocketElement.send("SCENELIST");
-	websocketElement.send("ATHOME");
+function SyncState() {
+	websocketElement.send("SYNC~" + stateVersion + "~" + stateEpoch);
+}
+
+function updateRoom(room) {
+	if (typeof room_list.Rooms == 'undefined') {
+		return;
+	}
+	var found = false;
+	room_list.Rooms.forEach(function (roomItem) {
+		if (roomItem.Name === room.Name) {
+			roomItem.currentTemp = room.currentTemp;
+			roomItem.currentSetpoint = room.currentSetpoint;
+			found = true;
+			updateSingleRoom();
+		}
+	});
+	if (!found) {
+		room_list.Rooms = room_list.Rooms.concat([room]);
+	}
+}
+
+function removeRoom(name) {
+	if (typeof room_list.Rooms == 'undefined') {
+		return;
+	}
+	room_list.Rooms = room_list.Rooms.filter(function (roomItem) {
+		return roomItem.Name !== name;
+	});
+}
+
+function updateNode(node) {
+	if (typeof single_room.Devices == 'undefined') {
+		return;
+	}
+	var devices = single_room.Devices.filter(function (device) {
+		return device.ID !== node.ID;
+	});
+	devices.push(node);
+	single_room.Devices = devices;
+}
+
+function removeNode(id) {
+	if (typeof single_room.Devices == 'undefined') {
+		return;
+	}
+	single_room.Devices = single_room.Devices.filter(function (device) {
+		return device.ID !== id;
+	});
+}
+
+function updateValue(value) {
+	if (typeof single_room.Devices == 'undefined') {
+		return;
+	}
+	single_room.Devices.forEach(function (device) {
+		if (device.ID === value.node && device.Values) {
+			device.Values[value.label] = value.value;
+		}
+	});
 }
 
 function updateSingleRoom() {
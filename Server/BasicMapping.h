@@ -0,0 +1,103 @@
+#ifndef OZWSS_BASICMAPPING_H_
+#define OZWSS_BASICMAPPING_H_
+
+#include "Defs.h"
+
+namespace OZWSS {
+	// A device class that maps the basic command class onto a specific one.
+	// A specific of 0 means the mapping holds for every specific of the generic.
+	struct BasicMappingEntry {
+		uint8	generic;
+		uint8	specific;
+		uint8	commandClass;
+	};
+
+	constexpr BasicMappingEntry s_basicMappings[] = {
+		{ 0x03, 0x11, 0x94 },
+		{ 0x03, 0x12, 0x30 },
+		{ 0x08, 0x02, 0x40 },
+		{ 0x08, 0x03, 0x46 },
+		{ 0x08, 0x04, 0x43 },
+		{ 0x08, 0x05, 0x40 },
+		{ 0x08, 0x06, 0x40 },
+		{ 0x09, 0x01, 0x50 },
+		{ 0x10, 0x00, 0x25 },
+		{ 0x11, 0x00, 0x26 },
+		{ 0x12, 0x01, 0x25 },
+		{ 0x12, 0x02, 0x26 },
+		{ 0x12, 0x03, 0x28 },
+		{ 0x12, 0x04, 0x29 },
+		{ 0x13, 0x01, 0x28 },
+		{ 0x13, 0x02, 0x29 },
+		{ 0x16, 0x01, 0x39 },
+		{ 0x20, 0x00, 0x30 },
+		{ 0x21, 0x00, 0x31 },
+		{ 0x30, 0x00, 0x35 },
+		{ 0x31, 0x01, 0x32 },
+		{ 0x40, 0x01, 0x62 },
+		{ 0x40, 0x02, 0x62 },
+		{ 0x40, 0x03, 0x62 },
+		{ 0xa1, 0x00, 0x71 }
+	};
+
+	// The entries above laid out for direct lookup: m_specific is indexed by
+	// (generic<<8 | specific), m_generic by generic alone. 0 means no mapping.
+	struct BasicMappingTable {
+		uint8	m_specific[0x10000];
+		uint8	m_generic[0x100];
+
+		constexpr BasicMappingTable() : m_specific(), m_generic() {
+			for(unsigned i = 0; i < sizeof(s_basicMappings) / sizeof(s_basicMappings[0]); ++i) {
+				if(s_basicMappings[i].specific == 0) {
+					m_generic[s_basicMappings[i].generic] = s_basicMappings[i].commandClass;
+				}
+				else {
+					m_specific[(s_basicMappings[i].generic << 8) | s_basicMappings[i].specific] = s_basicMappings[i].commandClass;
+				}
+			}
+		}
+
+		// the command class the basic command class of a device maps to,
+		// or 0 if it has no mapping
+		constexpr uint8 Map(uint8 generic, uint8 specific) const {
+			return m_specific[(generic << 8) | specific] != 0 ? m_specific[(generic << 8) | specific] : m_generic[generic];
+		}
+	};
+
+	constexpr BasicMappingTable s_basicMappingTable;
+
+	inline uint8 MapBasicCommandClass(uint8 generic, uint8 specific) {
+		return s_basicMappingTable.Map(generic, specific);
+	}
+
+	// The table has to give the same answers as the string keyed map it replaces
+	static_assert(s_basicMappingTable.Map(0x03, 0x11) == 0x94, "0x03|0x11");
+	static_assert(s_basicMappingTable.Map(0x03, 0x12) == 0x30, "0x03|0x12");
+	static_assert(s_basicMappingTable.Map(0x08, 0x02) == 0x40, "0x08|0x02");
+	static_assert(s_basicMappingTable.Map(0x08, 0x03) == 0x46, "0x08|0x03");
+	static_assert(s_basicMappingTable.Map(0x08, 0x04) == 0x43, "0x08|0x04");
+	static_assert(s_basicMappingTable.Map(0x08, 0x05) == 0x40, "0x08|0x05");
+	static_assert(s_basicMappingTable.Map(0x08, 0x06) == 0x40, "0x08|0x06");
+	static_assert(s_basicMappingTable.Map(0x09, 0x01) == 0x50, "0x09|0x01");
+	static_assert(s_basicMappingTable.Map(0x10, 0x01) == 0x25, "0x10");
+	static_assert(s_basicMappingTable.Map(0x11, 0x07) == 0x26, "0x11");
+	static_assert(s_basicMappingTable.Map(0x12, 0x01) == 0x25, "0x12|0x01");
+	static_assert(s_basicMappingTable.Map(0x12, 0x02) == 0x26, "0x12|0x02");
+	static_assert(s_basicMappingTable.Map(0x12, 0x03) == 0x28, "0x12|0x03");
+	static_assert(s_basicMappingTable.Map(0x12, 0x04) == 0x29, "0x12|0x04");
+	static_assert(s_basicMappingTable.Map(0x13, 0x01) == 0x28, "0x13|0x01");
+	static_assert(s_basicMappingTable.Map(0x13, 0x02) == 0x29, "0x13|0x02");
+	static_assert(s_basicMappingTable.Map(0x16, 0x01) == 0x39, "0x16|0x01");
+	static_assert(s_basicMappingTable.Map(0x20, 0x01) == 0x30, "0x20");
+	static_assert(s_basicMappingTable.Map(0x21, 0x01) == 0x31, "0x21");
+	static_assert(s_basicMappingTable.Map(0x30, 0x01) == 0x35, "0x30");
+	static_assert(s_basicMappingTable.Map(0x31, 0x01) == 0x32, "0x31|0x01");
+	static_assert(s_basicMappingTable.Map(0x40, 0x01) == 0x62, "0x40|0x01");
+	static_assert(s_basicMappingTable.Map(0x40, 0x02) == 0x62, "0x40|0x02");
+	static_assert(s_basicMappingTable.Map(0x40, 0x03) == 0x62, "0x40|0x03");
+	static_assert(s_basicMappingTable.Map(0xa1, 0x02) == 0x71, "0xa1");
+	static_assert(s_basicMappingTable.Map(0x08, 0x01) == 0, "no generic fallback for 0x08");
+	static_assert(s_basicMappingTable.Map(0x12, 0x05) == 0, "no generic fallback for 0x12");
+}
+
+#endif /* OZWSS_BASICMAPPING_H_ */
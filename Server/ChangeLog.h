@@ -0,0 +1,77 @@
+#ifndef OZWSS_CHANGELOG_H_
+#define OZWSS_CHANGELOG_H_
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+namespace OZWSS {
+	// Stamps every change of an entity with the next version of the state
+	// and remembers the last version per entity, for the most recently
+	// changed entities up to the capacity. That is enough to tell a client
+	// which entities changed after the version it has seen, as long as no
+	// entity it needs was pushed out in the meantime.
+	// Not thread safe, callers hold a lock.
+	template<typename Key>
+	class ChangeLog {
+		public:
+			ChangeLog(size_t capacity_) : m_capacity(capacity_), m_version(0), m_floor(0) {}
+
+			void SetCapacity(size_t capacity_) {
+				m_capacity = capacity_;
+				Trim();
+			}
+
+			// key_ changed, returns the new version of the state
+			uint64_t Stamp(Key const& key_) {
+				++m_version;
+				typename std::map<Key, uint64_t>::iterator it = m_byKey.find(key_);
+				if(it != m_byKey.end()) {
+					m_byVersion.erase(it->second);
+					it->second = m_version;
+				}
+				else {
+					m_byKey.insert(std::make_pair(key_, m_version));
+				}
+				m_byVersion.insert(std::make_pair(m_version, key_));
+				Trim();
+				return m_version;
+			}
+
+			uint64_t Version() const { return m_version; }
+			// the oldest version a client can ask the changes since
+			uint64_t Floor() const { return m_floor; }
+			size_t Size() const { return m_byVersion.size(); }
+
+			// The entities that changed after since_, oldest change first.
+			// Returns false if that is not known any more, or never was.
+			bool Since(uint64_t since_, std::vector<Key>& keys_) const {
+				if(since_ < m_floor || since_ > m_version) {
+					return false;
+				}
+				for(typename std::map<uint64_t, Key>::const_iterator it = m_byVersion.upper_bound(since_); it != m_byVersion.end(); ++it) {
+					keys_.push_back(it->second);
+				}
+				return true;
+			}
+
+		private:
+			void Trim() {
+				while(m_byVersion.size() > m_capacity) {
+					typename std::map<uint64_t, Key>::iterator oldest = m_byVersion.begin();
+					m_floor = oldest->first;
+					m_byKey.erase(oldest->second);
+					m_byVersion.erase(oldest);
+				}
+			}
+
+			size_t						m_capacity;
+			uint64_t					m_version;
+			uint64_t					m_floor;	// changes up to this version may be gone
+			std::map<uint64_t, Key>		m_byVersion;
+			std::map<Key, uint64_t>		m_byKey;
+	};
+}
+
+#endif /* OZWSS_CHANGELOG_H_ */
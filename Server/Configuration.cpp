@@ -6,8 +6,9 @@
 #include <stdexcept>
 #include <sstream>
 #include <map>
+#include <cstdlib>
 namespace OZWSS {
-	enum contents {Undefined = 0, tcp_port_n, ws_port_n, lat_n, lon_n, morningScene_n, dayScene_n, nightScene_n, awayScene_n, certificate_n, certificate_key_n, google_client_id_n, google_client_secret_n};
+	enum contents {Undefined = 0, tcp_port_n, ws_port_n, lat_n, lon_n, morningScene_n, dayScene_n, nightScene_n, awayScene_n, certificate_n, certificate_key_n, google_client_id_n, google_client_secret_n, notification_queue_size_n, notification_overflow_n, websocket_queue_messages_n, websocket_queue_bytes_n, websocket_slow_consumer_n, websocket_deflate_level_n, websocket_deflate_min_size_n, debounce_values_n, debounce_rooms_n, debounce_scenes_n, debounce_structure_n, change_log_size_n, command_workers_n, command_write_workers_n, command_queue_size_n, unix_socket_n, unix_socket_trusted_uids_n, radio_send_queue_limit_n, radio_rate_limit_n, unix_socket_mode_n};
 	static std::map<std::string, contents> s_mapStringValues;
 
 	template <typename T>
@@ -23,10 +24,20 @@ namespace OZWSS {
 	}
 
 	Configuration::Configuration(std::string conf_ini_location_) : conf_ini_location(conf_ini_location_),
-			lat(0.0), lon(0.0), ws_port(0), tcp_port(""),
+			lat(0.0), lon(0.0), ws_port(0), notification_queue_size(1024), websocket_queue_messages(64), websocket_queue_bytes(1048576), websocket_deflate_level(6), websocket_deflate_min_size(256), change_log_size(4096), command_workers(4), command_write_workers(1), command_queue_size(256), radio_send_queue_limit(16), tcp_port(""),
 			morningScene(""), dayScene(""), nightScene(""), awayScene(""),
 			certificate(""), certificate_key(""),
-			google_client_id(""), google_client_secret("")
+			google_client_id(""), google_client_secret(""),
+			notification_overflow("block"),
+			websocket_slow_consumer("drop_oldest"),
+			debounce_values("250,2000"),
+			debounce_rooms("250,2000"),
+			debounce_scenes("0,1000"),
+			debounce_structure("1000,10000"),
+			unix_socket(""),
+			unix_socket_trusted_uids(""),
+			radio_rate_limit("5,10"),
+			unix_socket_mode("0660")
 	{
 		create_string_map();
 		std::ifstream conffile;
@@ -116,6 +127,67 @@ namespace OZWSS {
 					break;
 				case google_client_secret_n:
 					google_client_secret = value;
+					break;
+				case notification_queue_size_n:
+					notification_queue_size = lexical_cast<int>(value);
+					break;
+				case notification_overflow_n:
+					notification_overflow = value;
+					break;
+				case websocket_queue_messages_n:
+					websocket_queue_messages = lexical_cast<int>(value);
+					break;
+				case websocket_queue_bytes_n:
+					websocket_queue_bytes = lexical_cast<int>(value);
+					break;
+				case websocket_slow_consumer_n:
+					websocket_slow_consumer = value;
+					break;
+				case websocket_deflate_level_n:
+					websocket_deflate_level = lexical_cast<int>(value);
+					break;
+				case websocket_deflate_min_size_n:
+					websocket_deflate_min_size = lexical_cast<int>(value);
+					break;
+				case debounce_values_n:
+					debounce_values = value;
+					break;
+				case debounce_rooms_n:
+					debounce_rooms = value;
+					break;
+				case debounce_scenes_n:
+					debounce_scenes = value;
+					break;
+				case debounce_structure_n:
+					debounce_structure = value;
+					break;
+				case change_log_size_n:
+					change_log_size = lexical_cast<int>(value);
+					break;
+				case command_workers_n:
+					command_workers = lexical_cast<int>(value);
+					break;
+				case command_write_workers_n:
+					command_write_workers = lexical_cast<int>(value);
+					break;
+				case command_queue_size_n:
+					command_queue_size = lexical_cast<int>(value);
+					break;
+				case unix_socket_n:
+					unix_socket = value;
+					break;
+				case unix_socket_trusted_uids_n:
+					unix_socket_trusted_uids = value;
+					break;
+				case radio_send_queue_limit_n:
+					radio_send_queue_limit = lexical_cast<int>(value);
+					break;
+				case radio_rate_limit_n:
+					radio_rate_limit = value;
+					break;
+				case unix_socket_mode_n:
+					unix_socket_mode = value;
+					break;
 				default:
 					return false;
 					break;
@@ -140,6 +212,26 @@ namespace OZWSS {
 		s_mapStringValues["certificate_key"] = certificate_key_n;
 		s_mapStringValues["google_client_id"] = google_client_id_n;
 		s_mapStringValues["google_client_secret"] = google_client_secret_n;
+		s_mapStringValues["notification_queue_size"] = notification_queue_size_n;
+		s_mapStringValues["notification_overflow"] = notification_overflow_n;
+		s_mapStringValues["websocket_queue_messages"] = websocket_queue_messages_n;
+		s_mapStringValues["websocket_queue_bytes"] = websocket_queue_bytes_n;
+		s_mapStringValues["websocket_slow_consumer"] = websocket_slow_consumer_n;
+		s_mapStringValues["websocket_deflate_level"] = websocket_deflate_level_n;
+		s_mapStringValues["websocket_deflate_min_size"] = websocket_deflate_min_size_n;
+		s_mapStringValues["debounce_values"] = debounce_values_n;
+		s_mapStringValues["debounce_rooms"] = debounce_rooms_n;
+		s_mapStringValues["debounce_scenes"] = debounce_scenes_n;
+		s_mapStringValues["debounce_structure"] = debounce_structure_n;
+		s_mapStringValues["change_log_size"] = change_log_size_n;
+		s_mapStringValues["command_workers"] = command_workers_n;
+		s_mapStringValues["command_write_workers"] = command_write_workers_n;
+		s_mapStringValues["command_queue_size"] = command_queue_size_n;
+		s_mapStringValues["unix_socket"] = unix_socket_n;
+		s_mapStringValues["unix_socket_trusted_uids"] = unix_socket_trusted_uids_n;
+		s_mapStringValues["radio_send_queue_limit"] = radio_send_queue_limit_n;
+		s_mapStringValues["radio_rate_limit"] = radio_rate_limit_n;
+		s_mapStringValues["unix_socket_mode"] = unix_socket_mode_n;
 	}
 
 	bool Configuration::GetTCPPort(std::string &port_) {
@@ -191,4 +283,131 @@ namespace OZWSS {
 		client_secret_ = google_client_secret;
 		return true;
 	}
+	bool Configuration::GetNotificationQueue(int &size_, std::string &overflow_) {
+		if(notification_queue_size <= 0) {
+			return false;
+		}
+		size_ = notification_queue_size;
+		overflow_ = notification_overflow;
+		return true;
+	}
+	bool Configuration::GetWebsocketQueue(int &messages_, int &bytes_, std::string &slow_consumer_) {
+		if(websocket_queue_messages <= 0 || websocket_queue_bytes <= 0) {
+			return false;
+		}
+		messages_ = websocket_queue_messages;
+		bytes_ = websocket_queue_bytes;
+		slow_consumer_ = websocket_slow_consumer;
+		return true;
+	}
+	bool Configuration::GetWebsocketDeflate(int &level_, int &min_size_) {
+		if(websocket_deflate_level <= 0) {
+			return false;
+		}
+		level_ = websocket_deflate_level > 9 ? 9 : websocket_deflate_level;
+		min_size_ = websocket_deflate_min_size;
+		return true;
+	}
+	bool Configuration::GetDebounce(std::string const& class_, int &min_, int &max_) {
+		std::string window;
+		if(class_ == "values") {
+			window = debounce_values;
+		}
+		else if(class_ == "rooms") {
+			window = debounce_rooms;
+		}
+		else if(class_ == "scenes") {
+			window = debounce_scenes;
+		}
+		else if(class_ == "structure") {
+			window = debounce_structure;
+		}
+		std::string::size_type comma = window.find(',');
+		if(comma == std::string::npos) {
+			return false;
+		}
+		try {
+			int min = lexical_cast<int>(window.substr(0, comma));
+			int max = lexical_cast<int>(window.substr(comma + 1));
+			if(min < 0 || max < 0) {
+				return false;
+			}
+			min_ = min;
+			max_ = max;
+		}
+		catch (std::exception const& e) {
+			return false;
+		}
+		return true;
+	}
+	bool Configuration::GetChangeLogSize(int &size_) {
+		if(change_log_size <= 0) {
+			return false;
+		}
+		size_ = change_log_size;
+		return true;
+	}
+	bool Configuration::GetCommandWorkers(int &workers_, int &write_workers_, int &queue_size_) {
+		if(command_workers <= 0 || command_write_workers <= 0 || command_queue_size <= 0) {
+			return false;
+		}
+		workers_ = command_workers;
+		write_workers_ = command_write_workers;
+		queue_size_ = command_queue_size;
+		return true;
+	}
+	bool Configuration::GetUnixSocket(std::string &path_, int &mode_, std::vector<int> &trusted_uids_) {
+		if(unix_socket.empty()) {
+			return false;
+		}
+		// an octal file mode like chmod takes
+		char* end = NULL;
+		long mode = strtol(unix_socket_mode.c_str(), &end, 8);
+		if(unix_socket_mode.empty() || *end != '\0' || mode < 0 || mode > 0777) {
+			return false;
+		}
+		std::vector<int> uids;
+		std::stringstream list(unix_socket_trusted_uids);
+		std::string uid;
+		try {
+			while(getline(list, uid, ',')) {
+				if(!uid.empty()) {
+					uids.push_back(lexical_cast<int>(uid));
+				}
+			}
+		}
+		catch (std::exception const& e) {
+			return false;
+		}
+		path_ = unix_socket;
+		mode_ = mode;
+		trusted_uids_ = uids;
+		return true;
+	}
+	bool Configuration::GetRadioRateLimit(double &rate_, int &burst_) {
+		std::string::size_type comma = radio_rate_limit.find(',');
+		if(comma == std::string::npos) {
+			return false;
+		}
+		try {
+			double rate = lexical_cast<double>(radio_rate_limit.substr(0, comma));
+			int burst = lexical_cast<int>(radio_rate_limit.substr(comma + 1));
+			if(rate <= 0 || burst <= 0) {
+				return false;
+			}
+			rate_ = rate;
+			burst_ = burst;
+		}
+		catch (std::exception const& e) {
+			return false;
+		}
+		return true;
+	}
+	bool Configuration::GetRadioSendQueueLimit(int &limit_) {
+		if(radio_send_queue_limit <= 0) {
+			return false;
+		}
+		limit_ = radio_send_queue_limit;
+		return true;
+	}
 } // namespace
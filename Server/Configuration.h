@@ -2,13 +2,14 @@
 #define OZWSS_CONFIGURATION_H_
 
 #include <string>
+#include <vector>
 namespace OZWSS {
 	class Configuration {
 		private:
 			std::string conf_ini_location;
 			float lat, lon;
-			int ws_port;
-			std::string tcp_port, morningScene, dayScene, nightScene, awayScene, certificate, certificate_key, google_client_id, google_client_secret;
+			int ws_port, notification_queue_size, websocket_queue_messages, websocket_queue_bytes, websocket_deflate_level, websocket_deflate_min_size, change_log_size, command_workers, command_write_workers, command_queue_size, radio_send_queue_limit;
+			std::string tcp_port, morningScene, dayScene, nightScene, awayScene, certificate, certificate_key, google_client_id, google_client_secret, notification_overflow, websocket_slow_consumer, debounce_values, debounce_rooms, debounce_scenes, debounce_structure, unix_socket, unix_socket_trusted_uids, radio_rate_limit, unix_socket_mode;
 			bool open_filestream(std::ifstream& conffile);
 			bool parse_filestream(std::ifstream& conffile);
 			bool parse_variable(std::string name, std::string value);
@@ -24,6 +25,15 @@ namespace OZWSS {
 			bool GetAwayScene(std::string &awayScene_);
 			bool GetCertificateInfo(std::string &certificate_, std::string &certificate_key_);
 			bool GetGoogleClientIdAndSecret(std::string &client_id_, std::string &client_secret_);
+			bool GetNotificationQueue(int &size_, std::string &overflow_);
+			bool GetWebsocketQueue(int &messages_, int &bytes_, std::string &slow_consumer_);
+			bool GetWebsocketDeflate(int &level_, int &min_size_);
+			bool GetDebounce(std::string const& class_, int &min_, int &max_);
+			bool GetChangeLogSize(int &size_);
+			bool GetCommandWorkers(int &workers_, int &write_workers_, int &queue_size_);
+			bool GetUnixSocket(std::string &path_, int &mode_, std::vector<int> &trusted_uids_);
+			bool GetRadioRateLimit(double &rate_, int &burst_);
+			bool GetRadioSendQueueLimit(int &limit_);
 	};
 }
 #endif // OZWSS_CONFIGURATION_H_
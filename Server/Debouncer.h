@@ -0,0 +1,86 @@
+#ifndef OZWSS_DEBOUNCER_H_
+#define OZWSS_DEBOUNCER_H_
+
+#include <vector>
+#include <stdint.h>
+
+namespace OZWSS {
+	// Decides when collected changes are sent, per class of change.
+	// The first change after a quiet period is due at once. Changes that
+	// follow within the minimum window are batched: they are due when no
+	// other change came in for the minimum window, but never later than the
+	// maximum window after the first of them.
+	// Times are in milliseconds. Not thread safe, callers hold a lock.
+	class Debouncer {
+		public:
+			Debouncer(unsigned classes_) : m_classes(classes_) {}
+
+			void SetWindow(unsigned class_, uint64_t min_, uint64_t max_) {
+				m_classes[class_].min = min_;
+				m_classes[class_].max = max_ < min_ ? min_ : max_;
+			}
+
+			// A change of class_ came in at now
+			void Change(unsigned class_, uint64_t now) {
+				State& state = m_classes[class_];
+				++state.changes;
+				if(state.pending) {
+					state.due = now + state.min;
+					if(state.due > state.first + state.max) {
+						state.due = state.first + state.max;
+					}
+					return;
+				}
+				state.pending = true;
+				state.first = now;
+				state.due = (state.flushed == 0 || now >= state.flushed + state.min) ? now : now + state.min;
+			}
+
+			// The earliest time a class is due, 0 when nothing is pending
+			uint64_t Deadline() const {
+				uint64_t deadline = 0;
+				for(std::vector<State>::const_iterator it = m_classes.begin(); it != m_classes.end(); ++it) {
+					if(it->pending && (deadline == 0 || it->due < deadline)) {
+						deadline = it->due;
+					}
+				}
+				return deadline;
+			}
+
+			// The classes that are due at now, as a bit mask. They count as sent.
+			uint32_t Due(uint64_t now) {
+				uint32_t due = 0;
+				for(unsigned i = 0; i < m_classes.size(); ++i) {
+					State& state = m_classes[i];
+					if(state.pending && state.due <= now) {
+						due |= 1 << i;
+						state.pending = false;
+						state.flushed = now;
+						++state.flushes;
+					}
+				}
+				return due;
+			}
+
+			uint64_t Changes(unsigned class_) const { return m_classes[class_].changes; }
+			uint64_t Flushes(unsigned class_) const { return m_classes[class_].flushes; }
+
+		private:
+			struct State {
+				uint64_t	min;
+				uint64_t	max;
+				bool		pending;
+				uint64_t	first;		// first change since the last flush
+				uint64_t	due;
+				uint64_t	flushed;	// time of the last flush
+				uint64_t	changes;
+				uint64_t	flushes;
+
+				State() : min(0), max(0), pending(false), first(0), due(0), flushed(0), changes(0), flushes(0) {}
+			};
+
+			std::vector<State>	m_classes;
+	};
+}
+
+#endif /* OZWSS_DEBOUNCER_H_ */
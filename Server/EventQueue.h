@@ -0,0 +1,152 @@
+#ifndef OZWSS_EVENTQUEUE_H_
+#define OZWSS_EVENTQUEUE_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace OZWSS {
+	// Bounded lock-free queue for many producers and a single consumer.
+	// This is Dmitry Vyukov's bounded MPMC queue: producers claim a cell with a
+	// CAS on the enqueue position and never take a lock. The consumer sleeps on
+	// a semaphore that holds one token per published item.
+	template <typename T>
+	class EventQueue {
+		public:
+			EventQueue(size_t capacity_) : m_capacity(1), m_enqueuePos(0), m_dequeuePos(0), m_highWater(0), m_pushed(0), m_dropped(0) {
+				while(m_capacity < capacity_) {
+					m_capacity <<= 1;
+				}
+				m_mask = m_capacity - 1;
+				m_cells = new Cell[m_capacity];
+				for(size_t i = 0; i < m_capacity; ++i) {
+					m_cells[i].sequence.store(i, std::memory_order_relaxed);
+				}
+				sem_init(&m_items, 0, 0);
+			}
+
+			~EventQueue() {
+				sem_destroy(&m_items);
+				delete[] m_cells;
+			}
+
+			// Queue an item. When the queue is full a blocking push waits for the
+			// consumer to make room, otherwise the item is dropped and counted.
+			bool Push(T const& item, bool block) {
+				while(!TryPush(item)) {
+					if(!block) {
+						m_dropped.fetch_add(1, std::memory_order_relaxed);
+						return false;
+					}
+					usleep(100);
+				}
+				m_pushed.fetch_add(1, std::memory_order_relaxed);
+				size_t depth = Depth();
+				size_t highWater = m_highWater.load(std::memory_order_relaxed);
+				while(depth > highWater && !m_highWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {}
+				sem_post(&m_items);
+				return true;
+			}
+
+			// Take the next item, waiting at most timeout_ms for one to arrive
+			bool Pop(T& item, int timeout_ms) {
+				struct timespec deadline;
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += timeout_ms / 1000;
+				deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+				if(deadline.tv_nsec >= 1000000000L) {
+					deadline.tv_sec += 1;
+					deadline.tv_nsec -= 1000000000L;
+				}
+				while(sem_timedwait(&m_items, &deadline) != 0) {
+					if(errno != EINTR) {
+						return false;
+					}
+				}
+				TakeClaimed(item);
+				return true;
+			}
+
+			// Take the next item if there is one, without waiting
+			bool TryPop(T& item) {
+				if(sem_trywait(&m_items) != 0) {
+					return false;
+				}
+				TakeClaimed(item);
+				return true;
+			}
+
+			size_t Capacity() const { return m_capacity; }
+			size_t Depth() const {
+				size_t enqueuePos = m_enqueuePos.load(std::memory_order_relaxed);
+				size_t dequeuePos = m_dequeuePos.load(std::memory_order_relaxed);
+				return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+			}
+			size_t HighWater() const { return m_highWater.load(std::memory_order_relaxed); }
+			uint64_t Pushed() const { return m_pushed.load(std::memory_order_relaxed); }
+			uint64_t Dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+		private:
+			struct Cell {
+				std::atomic<size_t>	sequence;
+				T					data;
+			};
+
+			EventQueue(EventQueue const&);
+			EventQueue& operator=(EventQueue const&);
+
+			bool TryPush(T const& item) {
+				size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+				for(;;) {
+					Cell* cell = &m_cells[pos & m_mask];
+					size_t sequence = cell->sequence.load(std::memory_order_acquire);
+					intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+					if(diff == 0) {
+						if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+							cell->data = item;
+							cell->sequence.store(pos + 1, std::memory_order_release);
+							return true;
+						}
+					}
+					else if(diff < 0) {
+						return false;
+					}
+					else {
+						pos = m_enqueuePos.load(std::memory_order_relaxed);
+					}
+				}
+			}
+
+			// We hold a semaphore token, so an item is published or about to be
+			// published by a producer that already claimed its cell
+			void TakeClaimed(T& item) {
+				size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+				Cell* cell = &m_cells[pos & m_mask];
+				while(cell->sequence.load(std::memory_order_acquire) != pos + 1) {
+					sched_yield();
+				}
+				item = cell->data;
+				cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+				m_dequeuePos.store(pos + 1, std::memory_order_relaxed);
+			}
+
+			Cell*				m_cells;
+			size_t				m_capacity;
+			size_t				m_mask;
+			char				m_pad0[64];
+			std::atomic<size_t>	m_enqueuePos;
+			char				m_pad1[64];
+			std::atomic<size_t>	m_dequeuePos;
+			char				m_pad2[64];
+			std::atomic<size_t>	m_highWater;
+			std::atomic<uint64_t>	m_pushed;
+			std::atomic<uint64_t>	m_dropped;
+			sem_t				m_items;
+	};
+}
+#endif // OZWSS_EVENTQUEUE_H_
@@ -0,0 +1,206 @@
+#ifndef OZWSS_EXECUTOR_H_
+#define OZWSS_EXECUTOR_H_
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+
+namespace OZWSS {
+	// Worker threads that run jobs, in lanes. Every lane has its own workers
+	// and its own bounded queue, so slow jobs in one lane do not hold up the
+	// jobs in another. Jobs are functions with the signature of a pthread
+	// start routine. Every job has a kind; per kind the time jobs waited in
+	// the queue and the time they ran are recorded.
+	class Executor {
+		public:
+			typedef void *(*Job)(void*);
+
+			struct LaneStats {
+				std::string		name;
+				size_t			workers;
+				size_t			capacity;
+				size_t			depth;
+				size_t			highWater;
+				uint64_t		rejected;
+			};
+
+			struct KindStats {
+				uint64_t		jobs;
+				uint64_t		waitTotal;		// microseconds
+				uint64_t		waitMax;
+				uint64_t		runTotal;
+				uint64_t		runMax;
+
+				KindStats() : jobs(0), waitTotal(0), waitMax(0), runTotal(0), runMax(0) {}
+			};
+
+			Executor(size_t kinds_) : m_kinds(kinds_) {
+				pthread_mutex_init(&m_statsLock, NULL);
+			}
+
+			// Runs the jobs that are still queued, then stops the workers
+			~Executor() {
+				for(std::vector<Lane*>::iterator it = m_lanes.begin(); it != m_lanes.end(); ++it) {
+					pthread_mutex_lock(&(*it)->lock);
+					(*it)->stopping = true;
+					pthread_cond_broadcast(&(*it)->cond);
+					pthread_mutex_unlock(&(*it)->lock);
+				}
+				for(std::vector<Lane*>::iterator it = m_lanes.begin(); it != m_lanes.end(); ++it) {
+					for(std::vector<pthread_t>::iterator tit = (*it)->threads.begin(); tit != (*it)->threads.end(); ++tit) {
+						pthread_join(*tit, NULL);
+					}
+					pthread_cond_destroy(&(*it)->cond);
+					pthread_mutex_destroy(&(*it)->lock);
+					delete *it;
+				}
+				pthread_mutex_destroy(&m_statsLock);
+			}
+
+			// Add a lane before the first Submit, returns its number
+			unsigned AddLane(std::string const& name_, size_t workers_, size_t capacity_) {
+				Lane* lane = new Lane();
+				lane->executor = this;
+				lane->name = name_;
+				lane->capacity = capacity_;
+				lane->highWater = 0;
+				lane->rejected = 0;
+				lane->stopping = false;
+				pthread_mutex_init(&lane->lock, NULL);
+				pthread_cond_init(&lane->cond, NULL);
+				m_lanes.push_back(lane);
+				for(size_t i = 0; i < workers_; ++i) {
+					pthread_t thread;
+					if(pthread_create(&thread, NULL, Worker, lane) == 0) {
+						lane->threads.push_back(thread);
+					}
+				}
+				return m_lanes.size() - 1;
+			}
+
+			// Queue a job. Returns false, and does not run it, when the lane is full.
+			bool Submit(unsigned lane_, unsigned kind_, Job job_, void* arg_) {
+				Lane* lane = m_lanes[lane_];
+				Entry entry;
+				entry.job = job_;
+				entry.arg = arg_;
+				entry.kind = kind_ < m_kinds.size() ? kind_ : 0;
+				entry.queued = Now();
+				pthread_mutex_lock(&lane->lock);
+				if(lane->stopping || lane->jobs.size() >= lane->capacity) {
+					++lane->rejected;
+					pthread_mutex_unlock(&lane->lock);
+					return false;
+				}
+				lane->jobs.push_back(entry);
+				if(lane->jobs.size() > lane->highWater) {
+					lane->highWater = lane->jobs.size();
+				}
+				pthread_cond_signal(&lane->cond);
+				pthread_mutex_unlock(&lane->lock);
+				return true;
+			}
+
+			size_t Lanes() const { return m_lanes.size(); }
+
+			LaneStats GetLaneStats(unsigned lane_) {
+				Lane* lane = m_lanes[lane_];
+				LaneStats stats;
+				pthread_mutex_lock(&lane->lock);
+				stats.name = lane->name;
+				stats.workers = lane->threads.size();
+				stats.capacity = lane->capacity;
+				stats.depth = lane->jobs.size();
+				stats.highWater = lane->highWater;
+				stats.rejected = lane->rejected;
+				pthread_mutex_unlock(&lane->lock);
+				return stats;
+			}
+
+			KindStats GetKindStats(unsigned kind_) {
+				pthread_mutex_lock(&m_statsLock);
+				KindStats stats = m_kinds[kind_];
+				pthread_mutex_unlock(&m_statsLock);
+				return stats;
+			}
+
+		private:
+			struct Entry {
+				Job			job;
+				void*		arg;
+				unsigned	kind;
+				uint64_t	queued;
+			};
+
+			struct Lane {
+				Executor*				executor;
+				std::string				name;
+				size_t					capacity;
+				size_t					highWater;
+				uint64_t				rejected;
+				bool					stopping;
+				pthread_mutex_t			lock;
+				pthread_cond_t			cond;
+				std::deque<Entry>		jobs;
+				std::vector<pthread_t>	threads;
+			};
+
+			static uint64_t Now() {
+				struct timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+			}
+
+			static void *Worker(void* arg) {
+				Lane* lane = (Lane*) arg;
+				pthread_mutex_lock(&lane->lock);
+				while(true) {
+					while(lane->jobs.empty() && !lane->stopping) {
+						pthread_cond_wait(&lane->cond, &lane->lock);
+					}
+					if(lane->jobs.empty()) {
+						break;
+					}
+					Entry entry = lane->jobs.front();
+					lane->jobs.pop_front();
+					pthread_mutex_unlock(&lane->lock);
+
+					uint64_t started = Now();
+					entry.job(entry.arg);
+					lane->executor->Record(entry.kind, started - entry.queued, Now() - started);
+
+					pthread_mutex_lock(&lane->lock);
+				}
+				pthread_mutex_unlock(&lane->lock);
+				return 0;
+			}
+
+			void Record(unsigned kind, uint64_t wait, uint64_t run) {
+				pthread_mutex_lock(&m_statsLock);
+				KindStats& stats = m_kinds[kind];
+				++stats.jobs;
+				stats.waitTotal += wait;
+				stats.runTotal += run;
+				if(wait > stats.waitMax) {
+					stats.waitMax = wait;
+				}
+				if(run > stats.runMax) {
+					stats.runMax = run;
+				}
+				pthread_mutex_unlock(&m_statsLock);
+			}
+
+			Executor(Executor const&);
+			Executor& operator=(Executor const&);
+
+			std::vector<Lane*>		m_lanes;
+			pthread_mutex_t			m_statsLock;
+			std::vector<KindStats>	m_kinds;
+	};
+}
+
+#endif /* OZWSS_EXECUTOR_H_ */
@@ -0,0 +1,44 @@
+#ifndef OZWSS_FRAME_H_
+#define OZWSS_FRAME_H_
+
+#include <memory>
+#include <string>
+#include <cstring>
+#include <stddef.h>
+
+namespace OZWSS {
+	// An outgoing message, copied once into a buffer with room before and
+	// after the payload for the websocket framing, so it can be handed to
+	// lws_write as is. A broadcast shares one Frame between all sessions.
+	// lws_write writes the frame header into the room before the payload;
+	// that is fine as long as all writes happen on the service thread.
+	class Frame {
+		public:
+			static std::shared_ptr<Frame> Create(std::string const& payload, size_t pre, size_t post) {
+				return std::shared_ptr<Frame>(new Frame(payload.data(), payload.length(), pre, post));
+			}
+
+			~Frame() {
+				delete[] m_buffer;
+			}
+
+			unsigned char* Payload() { return m_buffer + m_pre; }
+			unsigned char const* Payload() const { return m_buffer + m_pre; }
+			size_t Length() const { return m_length; }
+
+		private:
+			Frame(char const* data, size_t length, size_t pre, size_t post) : m_buffer(new unsigned char[pre + length + post]), m_pre(pre), m_length(length) {
+				memcpy(m_buffer + m_pre, data, m_length);
+			}
+			Frame(Frame const&);
+			Frame& operator=(Frame const&);
+
+			unsigned char*	m_buffer;
+			size_t			m_pre;
+			size_t			m_length;
+	};
+
+	typedef std::shared_ptr<Frame> FramePtr;
+}
+
+#endif /* OZWSS_FRAME_H_ */
@@ -0,0 +1,129 @@
+//-----------------------------------------------------------------------------
+// FrameBench.cpp
+//
+// Cost of getting one broadcast message to the writable callback of every
+// session, without libwebsockets. Compares the old path, a ringbuffer of
+// std::string messages copied per session into a padded stack buffer, with
+// the current one, a single OZWSS::Frame shared by the SendQueue of every
+// session and written from in place. lws_write itself is the same in both
+// and is replaced by a call that only touches the payload.
+//
+// usage: frame-bench [broadcasts]
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "Frame.h"
+#include "SendQueue.h"
+
+// The libwebsockets 2.x values of LWS_SEND_BUFFER_PRE_PADDING (LWS_PRE) and
+// LWS_SEND_BUFFER_POST_PADDING on 64 bit builds
+#define BENCH_PRE_PADDING 16
+#define BENCH_POST_PADDING 0
+
+#define MAX_MESSAGE_QUEUE 32
+
+namespace {
+	struct LWSMessage {
+		std::string			message;
+		bool				broadcast;
+		void				*wsi;
+	};
+
+	// Stands in for lws_write: reads the payload and keeps the compiler from
+	// dropping the copies that feed it
+	unsigned s_sink = 0;
+	__attribute__((noinline)) void Write(unsigned char const* payload, size_t length) {
+		s_sink += payload[0] + payload[length - 1];
+		__asm__ __volatile__("" : : "r"(payload) : "memory");
+	}
+
+	long long CpuNs() {
+		struct timespec ts;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+		return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+	//-----------------------------------------------------------------------------
+	// <RingBuffer>
+	// the old path: the broadcast is copied into the shared ringbuffer, every
+	// session copies the entry out and then the message into a padded VLA
+	//-----------------------------------------------------------------------------
+	void RingBuffer(std::string const& payload, int sessions, int broadcasts) {
+		std::vector<LWSMessage> ringbuffer(MAX_MESSAGE_QUEUE);
+		int ringbuffer_head = 0;
+		for(int b = 0; b < broadcasts; ++b) {
+			LWSMessage lwsmessage;
+			lwsmessage.message = payload;
+			lwsmessage.broadcast = true;
+			lwsmessage.wsi = NULL;
+			int const tail = ringbuffer_head;
+			ringbuffer[ringbuffer_head] = lwsmessage;
+			ringbuffer_head = (ringbuffer_head + 1) % MAX_MESSAGE_QUEUE;
+
+			for(int s = 0; s < sessions; ++s) {
+				LWSMessage entry = ringbuffer[tail];
+				char buf[BENCH_PRE_PADDING + entry.message.length() + BENCH_POST_PADDING];
+				memcpy(&buf[BENCH_PRE_PADDING], entry.message.c_str(), entry.message.length());
+				Write((unsigned char *) &buf[BENCH_PRE_PADDING], entry.message.length());
+			}
+		}
+	}
+
+	//-----------------------------------------------------------------------------
+	// <SharedFrame>
+	// the current path: one frame per broadcast, queued by reference on every
+	// session and written from its own buffer
+	//-----------------------------------------------------------------------------
+	void SharedFrame(std::string const& payload, int sessions, int broadcasts) {
+		std::vector<OZWSS::SendQueue> queues(sessions, OZWSS::SendQueue(64, 1024 * 1024, OZWSS::DropOldest, OZWSS::FramePtr()));
+		for(int b = 0; b < broadcasts; ++b) {
+			OZWSS::FramePtr frame = OZWSS::Frame::Create(payload, BENCH_PRE_PADDING, BENCH_POST_PADDING);
+			for(int s = 0; s < sessions; ++s) {
+				queues[s].Push(frame, true);
+			}
+			for(int s = 0; s < sessions; ++s) {
+				OZWSS::FramePtr next = queues[s].Next();
+				Write(next->Payload(), next->Length());
+				queues[s].Sent();
+			}
+		}
+	}
+
+	//-----------------------------------------------------------------------------
+	// <Run>
+	// time one path and print frames written per second and CPU per frame
+	//-----------------------------------------------------------------------------
+	void Run(char const* name, void (*path)(std::string const&, int, int), size_t bytes, int sessions, int broadcasts) {
+		std::string const payload(bytes, 'x');
+		long long const start = CpuNs();
+		path(payload, sessions, broadcasts);
+		long long const elapsed = CpuNs() - start;
+		double const frames = (double)broadcasts * sessions;
+		printf("%-12s %6zu bytes %3d sessions %12.0f frames/s %8.1f ns/frame\n", name, bytes, sessions,
+			frames * 1e9 / elapsed, elapsed / frames);
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int broadcasts = argc > 1 ? atoi(argv[1]) : 100000;
+	if(broadcasts <= 0) {
+		fprintf(stderr, "usage: %s [broadcasts]\n", argv[0]);
+		return 1;
+	}
+	// The sizes of a single value CHANGES, a typical CHANGES and a 20 node
+	// ALIST as printed by serializer-bench
+	size_t const sizes[] = { 143, 885, 7057 };
+	int const sessions[] = { 1, 8, 32 };
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+		for(size_t j = 0; j < sizeof(sessions) / sizeof(sessions[0]); ++j) {
+			Run("ringbuffer", RingBuffer, sizes[i], sessions[j], broadcasts);
+			Run("frame", SharedFrame, sizes[i], sessions[j], broadcasts);
+		}
+	}
+	return 0;
+}
@@ -48,14 +48,18 @@
 #include <stdlib.h>
 #include <stdexcept>
 #include <signal.h>
+#include <sched.h>
 #include <limits>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <set>
+#include <deque>
 
 //External classes and libs
 #include <libwebsockets.h>
 #include <json/json.h>
 #include <libsocket/unixclientstream.hpp>
-#include <libsocket/inetclientstream.hpp>
-#include <libsocket/inetserverstream.hpp>
 
 //Open-Zwave includes:
 #include "Options.h"
@@ -70,6 +74,17 @@
 #include "Sunrise.h"
 #include "Configuration.h"
 #include "ProtocolException.h"
+#include "ValueStore.h"
+#include "EventQueue.h"
+#include "BasicMapping.h"
+#include "Frame.h"
+#include "SendQueue.h"
+#include "Debouncer.h"
+#include "Serializer.h"
+#include "ChangeLog.h"
+#include "Executor.h"
+#include "SocketServer.h"
+#include "TokenBucket.h"
 
 using namespace OpenZWave;
 
@@ -83,9 +98,65 @@ typedef struct {
 	bool			m_needsSync;
 	time_t			m_LastSeen;
 	bool			m_polled;
-	list<ValueID>	m_values;
+	uint8			m_roles;
+	OZWSS::ValueStore	m_values;
+	std::string		m_name;
+	std::string		m_location;
+	std::string		m_type;
+	std::string		m_manufacturerName;
+	std::string		m_productName;
+	std::string		m_productId;
 } NodeInfo;
 
+//-----------------------------------------------------------------------------
+// Roles of a node, classified once so notifications only test bits
+//-----------------------------------------------------------------------------
+#define NODE_ROLE_THERMOSTAT			0x01
+#define NODE_ROLE_TEMPERATURE_SENSOR	0x02
+#define NODE_ROLE_WAKE_UP				0x04
+#define NODE_ROLE_CLOCK					0x08
+
+//-----------------------------------------------------------------------------
+// Tags for the value labels this server acts upon, assigned at ValueAdded
+//-----------------------------------------------------------------------------
+enum ValueTags {Untagged = 0, Heating_1, Temperature, Wake_up_Interval_Value, Default_Wake_up_Interval, Minimum_Wake_up_Interval, Maximum_Wake_up_Interval};
+
+//-----------------------------------------------------------------------------
+// Node registry, a dense table per home indexed by node id
+// g_nodes keeps the insertion order, every slot remembers its place in there
+//-----------------------------------------------------------------------------
+#define MAX_NODES 232
+
+struct NodeSlot {
+	NodeInfo*					info;
+	list<NodeInfo*>::iterator	pos;
+	std::shared_ptr<const NodeInfo>	published;
+	bool						dirty;
+};
+
+struct NodeTable {
+	NodeSlot		slots[MAX_NODES + 1];
+};
+
+//-----------------------------------------------------------------------------
+// Copy of an OpenZWave Notification, queued for the notification thread
+// The accessors mirror the ones of Notification
+//-----------------------------------------------------------------------------
+struct NotificationEvent {
+	Notification::NotificationType	type;
+	uint32							homeId;
+	uint8							nodeId;
+	uint64							valueId;
+	uint8							byte;
+
+	Notification::NotificationType GetType() const { return type; }
+	uint32 GetHomeId() const { return homeId; }
+	uint8 GetNodeId() const { return nodeId; }
+	ValueID GetValueID() const { return ValueID(homeId, valueId); }
+	uint8 GetEvent() const { return byte; }
+	uint8 GetNotification() const { return byte; }
+};
+
 //-----------------------------------------------------------------------------
 // Alarms in this Open-Zwave server have a time and a description
 //-----------------------------------------------------------------------------
@@ -104,6 +175,9 @@ struct Room {
 	float 			setpoint;
 	float			currentTemp;
 	bool			changed;
+	std::vector<uint8>	members;
+	std::vector<uint8>	thermostats;
+	std::vector<uint8>	sensors;
 	bool operator<(Room const &other) { return strcmp(name.c_str(), other.name.c_str()) < 0; }
 	bool operator==(Room const &other) { return (strcmp(name.c_str(), other.name.c_str()) == 0); }
 };
@@ -116,6 +190,110 @@ struct SceneListItem {
 	bool			active;
 };
 
+//-----------------------------------------------------------------------------
+// Immutable copy of the node, room and scene model
+// Writers build a new one under g_criticalSection and swap it in, readers
+// grab the current one and never have to wait for the lock
+// Unchanged nodes are shared between consecutive snapshots
+//-----------------------------------------------------------------------------
+struct StateSnapshot {
+	uint64											version;
+	uint64											roomsVersion;
+	uint64											scenesVersion;
+	std::vector<std::shared_ptr<const NodeInfo> >	nodes;
+	std::vector<Room>								rooms;
+	std::vector<SceneListItem>						scenes;
+};
+
+//-----------------------------------------------------------------------------
+// The parts of the state that are versioned for SYNC
+// Nodes and values are identified by home and id, rooms by name
+//-----------------------------------------------------------------------------
+enum EntityKinds {NodeEntity = 0, ValueEntity, RoomEntity, ScenesEntity, AtHomeEntity};
+
+struct StateEntity {
+	EntityKinds		kind;
+	uint32			homeId;
+	uint64			id;
+	std::string		name;
+
+	static StateEntity Node(uint32 homeId_, uint8 nodeId_) { return Make(NodeEntity, homeId_, nodeId_, ""); }
+	static StateEntity Value(uint32 homeId_, uint64 valueId_) { return Make(ValueEntity, homeId_, valueId_, ""); }
+	static StateEntity Room(std::string const& name_) { return Make(RoomEntity, 0, 0, name_); }
+	static StateEntity Scenes() { return Make(ScenesEntity, 0, 0, ""); }
+	static StateEntity AtHome() { return Make(AtHomeEntity, 0, 0, ""); }
+
+	static StateEntity Make(EntityKinds kind_, uint32 homeId_, uint64 id_, std::string const& name_) {
+		StateEntity entity;
+		entity.kind = kind_;
+		entity.homeId = homeId_;
+		entity.id = id_;
+		entity.name = name_;
+		return entity;
+	}
+
+	bool operator<(StateEntity const &other) const {
+		if(kind != other.kind) {
+			return kind < other.kind;
+		}
+		if(homeId != other.homeId) {
+			return homeId < other.homeId;
+		}
+		if(id != other.id) {
+			return id < other.id;
+		}
+		return name < other.name;
+	}
+};
+
+//-----------------------------------------------------------------------------
+// Changes that still have to be pushed to the websocket clients
+// Collected under g_criticalSection and sent as one CHANGES message when the
+// debouncer says their class is due, so a burst of reports ends up in a
+// single message
+//-----------------------------------------------------------------------------
+enum ChangeClasses {ValueChanges = 0, RoomChanges, SceneChanges, StructureChanges, NumChangeClasses};
+
+struct PendingChanges {
+	std::map<std::pair<uint32, uint64>, time_t>	values;
+	std::set<std::string>						rooms;
+	bool										scenes;
+	bool										atHome;
+	bool										structure;
+};
+
+//-----------------------------------------------------------------------------
+// The changes taken from PendingChanges, ready to be sent
+// Every change lists the topics it belongs to, so it only goes to the
+// clients that subscribed to one of them
+//-----------------------------------------------------------------------------
+struct Change {
+	Json::Value					json;
+	std::vector<std::string>	topics;
+};
+
+struct ChangeSet {
+	std::vector<Change>		values;
+	std::vector<Change>		rooms;
+	bool					scenes;
+	Json::Value				sceneList;
+	bool					atHome;
+	bool					structure;
+
+	ChangeSet() : scenes(false), atHome(false), structure(false) {}
+	bool HasChanges() const { return !values.empty() || !rooms.empty() || scenes || atHome; }
+};
+
+//-----------------------------------------------------------------------------
+// The commands of a BATCH run under one acquisition of g_criticalSection,
+// a configuration change is written once when all of them are done
+//-----------------------------------------------------------------------------
+struct CommandBatch {
+	bool			save;
+
+	CommandBatch() : save(false) {}
+};
+
 //-----------------------------------------------------------------------------
 // Cached values of Wake-up Intervals
 //-----------------------------------------------------------------------------
@@ -128,26 +306,70 @@ struct WakeupIntervalCacheItem {
 };
 
 //-----------------------------------------------------------------------------
-// LibWebSockets messages definitions
+// LibWebSockets sessions
+// Every websocket client has its own bounded queue of outgoing messages
 //-----------------------------------------------------------------------------
-#define MAX_MESSAGE_QUEUE 32
-
-struct LWSMessage {
-	std::string			message;
-	bool				broadcast;
+struct Session {
+	uint64				id;
 	struct lws			*wsi;
+	bool				authenticated;
+	bool				closing;
+	bool				deflate;	// compress the message being written
+	OZWSS::Encoding		encoding;	// chosen by the websocket subprotocol
+	OZWSS::SendQueue	queue;
+	std::set<std::string>	topics;
+	// commands run on the executor one at a time, so responses keep their order
+	std::deque<std::string>	commands;
+	bool				busy;		// a command of this session is on the executor
+	bool				gone;		// the connection closed while busy, the command deletes the session
+	OZWSS::TokenBucket	radio;		// limits the commands that send to the Z-Wave network
+	uint64				throttled;	// commands refused by AdmitCommand
+
+	Session(struct lws *wsi_, OZWSS::Encoding encoding_, OZWSS::SendQueue const& queue_, OZWSS::TokenBucket const& radio_) : id(0), wsi(wsi_), authenticated(false), closing(false), deflate(false), encoding(encoding_), queue(queue_), busy(false), gone(false), radio(radio_), throttled(0) {}
 };
 
-static std::vector<LWSMessage> ringbuffer (MAX_MESSAGE_QUEUE);
-static int ringbuffer_head = 0;
-
-struct lws_context *context;
+static list<Session*> g_sessions;
+// topic -> sessions subscribed to it, sessions without subscriptions are
+// listed under TOPIC_ALL and get every change
+static std::map<std::string, std::set<Session*> > g_interest;
+static uint64 g_sessionCount = 0;
+static pthread_mutex_t g_sessionLock = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<bool> g_broadcastPending(false);
+
+// permessage-deflate, messages smaller than g_deflateMinSize are sent as is
+static bool g_deflate = false;
+static int g_deflateLevel = 6;
+static size_t g_deflateMinSize = 256;
+static std::atomic<uint64_t> g_deflateMessages(0);
+static std::atomic<uint64_t> g_deflateSkipped(0);
+static std::atomic<uint64_t> g_deflateBytesIn(0);
+static std::atomic<uint64_t> g_deflateBytesOut(0);
+
+// admission of commands that send to the Z-Wave network: every client may
+// send g_radioRate of them per second with bursts of g_radioBurst, and none
+// are taken while the controller has g_radioQueueLimit messages waiting
+static double g_radioRate = 0;
+static int g_radioBurst = 0;
+static int g_radioQueueLimit = 0;
+static std::atomic<uint64_t> g_radioRateLimited(0);
+static std::atomic<uint64_t> g_radioBusy(0);
+
+// set by the websocket thread once the server runs, other threads only use
+// it to wake the service loop up
+static std::atomic<struct lws_context*> context(NULL);
 
 //-----------------------------------------------------------------------------
 // definitions
 //-----------------------------------------------------------------------------
 #define SOCKET_COLLECTION_TIMEOUT 10
 #define CACHE_INIT_TIMEOUT 5
+#define NOTIFICATION_WAIT_TIMEOUT 100
+#define MAX_NOTIFICATION_BATCH 64
+#define NOTIFICATION_DROP_LOG_INTERVAL 10 // seconds between reports of dropped value reports
+#define MAX_BATCH_COMMANDS 64
+#define MAX_SESSION_COMMANDS 64
+#define EXECUTOR_RETRY_MS 500
+#define RADIO_MESSAGE_MS 50 // rough time the controller needs for a queued message
 
 static bool stopping = false;
 static OZWSS::Configuration* conf;
@@ -155,24 +377,46 @@ static OZWSS::Configuration* conf;
 static uint32 g_homeId = 0;
 static bool g_initFailed = false;
 static bool atHome = false;
-static bool alarmset = false;
 static list<Alarm> alarmList;
+static pthread_mutex_t g_alarmLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_alarmCond = PTHREAD_COND_INITIALIZER;
+static uint64 g_alarmsRun = 0;
+static uint64 g_alarmLatencyTotal = 0;	// ms between the alarm time and running it
+static uint64 g_alarmLatencyMax = 0;
+static uint64 g_alarmRunTimeTotal = 0;	// ms spent running alarms
+static uint64 g_alarmRunTimeMax = 0;
+static OZWSS::Debouncer g_debouncer(NumChangeClasses);	// guarded by g_alarmLock
 static list<Room> roomList;
+static std::map<std::string, list<Room>::iterator> roomIndex;
 static list<SceneListItem> sceneList;
 static std::map<std::string, WakeupIntervalCacheItem> WakeupIntervalCache;
 static list<NodeInfo*> g_nodes;
+static std::map<uint32, NodeTable*> g_nodeTables;
+static std::shared_ptr<const StateSnapshot> g_snapshot;
+static uint64 g_snapshotVersion = 0;
+static uint64 g_roomsVersion = 0;
+static uint64 g_scenesVersion = 0;
+static bool g_stateChanged = false;
+static PendingChanges g_pendingChanges;
+static OZWSS::ChangeLog<StateEntity> g_changeLog(4096);	// guarded by g_criticalSection
+static time_t g_stateEpoch = time(NULL);	// versions only compare within one run of the server
+static uint64 g_syncFull = 0;
+static uint64 g_syncDelta = 0;
 static pthread_mutex_t g_criticalSection;
 static pthread_cond_t initCond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t initMutex = PTHREAD_MUTEX_INITIALIZER;
+static OZWSS::EventQueue<NotificationEvent>* g_notificationQueue = NULL;
+static bool g_notificationDropValues = false;
+static uint64 g_notificationsProcessed = 0;
 
 // Value-Defintions of the different String values
-enum Commands {Undefined_command = 0, Auth, AList, SetNode, RoomListC, RoomC, Plus, Minus, SceneListC, SceneC, Create, Add, Remove, Activate, ControllerC, Cancel, Reset, Cron, Switch, AtHome, PollInterval, AlarmList, Test, Exit};
-enum Triggers {Undefined_trigger = 0, Sunrise, Sunset, Thermostat, Update, Cache_init};
+enum Commands {Undefined_command = 0, Auth, AList, SetNode, RoomListC, RoomC, Plus, Minus, SceneListC, SceneC, Create, Add, Remove, Activate, ControllerC, Cancel, Reset, Cron, Switch, AtHome, PollInterval, AlarmList, Stats, Subscribe, Unsubscribe, EncodingC, Sync, Batch, Test, Exit, NumCommands};
+enum Triggers {Undefined_trigger = 0, Sunrise, Sunset, Thermostat, Cache_init};
 enum DeviceOptions {Undefined_Option = 0, Name, Location, SwitchC, Level, Thermostat_Setpoint, Polling, Wake_up_Interval, Battery_report};
 static std::map<std::string, Commands> s_mapStringCommands;
 static std::map<std::string, Triggers> s_mapStringTriggers;
 static std::map<std::string, DeviceOptions> s_mapStringOptions;
-static std::map<std::string, int> MapCommandClassBasic;
+static std::map<std::string, ValueTags> s_mapStringValueTags;
 
 void create_string_maps() {
 	s_mapStringCommands["AUTH"] = Auth;
@@ -196,13 +440,18 @@ void create_string_maps() {
 	s_mapStringCommands["ATHOME"] = AtHome;
 	s_mapStringCommands["POLLINTERVAL"] = PollInterval;
 	s_mapStringCommands["ALARMLIST"] = AlarmList;
+	s_mapStringCommands["STATS"] = Stats;
+	s_mapStringCommands["SUBSCRIBE"] = Subscribe;
+	s_mapStringCommands["UNSUBSCRIBE"] = Unsubscribe;
+	s_mapStringCommands["ENCODING"] = EncodingC;
+	s_mapStringCommands["SYNC"] = Sync;
+	s_mapStringCommands["BATCH"] = Batch;
 	s_mapStringCommands["TEST"] = Test;
 	s_mapStringCommands["EXIT"] = Exit;
 
 	s_mapStringTriggers["Sunrise"] = Sunrise;
 	s_mapStringTriggers["Sunset"] = Sunset;
 	s_mapStringTriggers["Thermostat"] = Thermostat;
-	s_mapStringTriggers["Update"] = Update;
 	s_mapStringTriggers["Cache init"] = Cache_init;
 
 	s_mapStringOptions["Name"] = Name;
@@ -214,49 +463,41 @@ void create_string_maps() {
 	s_mapStringOptions["Wake-up Interval"] = Wake_up_Interval;
 	s_mapStringOptions["Battery report"] = Battery_report;
 
-	MapCommandClassBasic["0x03|0x11"] = 0x94;
-	MapCommandClassBasic["0x03|0x12"] = 0x30;
-	MapCommandClassBasic["0x08|0x02"] = 0x40;
-	MapCommandClassBasic["0x08|0x03"] = 0x46;
-	MapCommandClassBasic["0x08|0x04"] = 0x43;
-	MapCommandClassBasic["0x08|0x05"] = 0x40;
-	MapCommandClassBasic["0x08|0x06"] = 0x40;
-	MapCommandClassBasic["0x09|0x01"] = 0x50;
-	MapCommandClassBasic["0x10"] = 0x25;
-	MapCommandClassBasic["0x11"] = 0x26;
-	MapCommandClassBasic["0x12|0x01"] = 0x25;
-	MapCommandClassBasic["0x12|0x02"] = 0x26;
-	MapCommandClassBasic["0x12|0x03"] = 0x28;
-	MapCommandClassBasic["0x12|0x04"] = 0x29;
-	MapCommandClassBasic["0x13|0x01"] = 0x28;
-	MapCommandClassBasic["0x13|0x02"] = 0x29;
-	MapCommandClassBasic["0x16|0x01"] = 0x39;
-	MapCommandClassBasic["0x20"] = 0x30;
-	MapCommandClassBasic["0x21"] = 0x31;
-	MapCommandClassBasic["0x30"] = 0x35;
-	MapCommandClassBasic["0x31|0x01"] = 0x32;
-	MapCommandClassBasic["0x40|0x01"] = 0x62;
-	MapCommandClassBasic["0x40|0x02"] = 0x62;
-	MapCommandClassBasic["0x40|0x03"] = 0x62;
-	MapCommandClassBasic["0xa1"] = 0x71;
+	s_mapStringValueTags["Heating 1"] = Heating_1;
+	s_mapStringValueTags["Temperature"] = Temperature;
+	s_mapStringValueTags["Wake-up Interval"] = Wake_up_Interval_Value;
+	s_mapStringValueTags["Default Wake-up Interval"] = Default_Wake_up_Interval;
+	s_mapStringValueTags["Minimum Wake-up Interval"] = Minimum_Wake_up_Interval;
+	s_mapStringValueTags["Maximum Wake-up Interval"] = Maximum_Wake_up_Interval;
+
 }
 
 //functions
 void OnControllerUpdate(uint8 cs);
+void ProcessNotification(NotificationEvent const* _notification);
+void *notification_main(void* arg);
 void sigint_handler(int sig);
 bool init_Rooms();
 bool init_Scenes();
 bool init_WakeupIntervalCache();
 void *websockets_main(void* arg);
+void* socket_opened(uint64 connection, OZWSS::SocketServer::Peer const& peer);
+void socket_received(uint64 connection, void* user, std::string const& data);
+void socket_closed(uint64 connection, void* user);
 void *run_socket(void* arg);
-void process_commands(std::string data, Json::Value& message);
+void *run_session(void* arg);
+Commands CommandOf(std::string const& name);
+bool SubmitCommand(std::string const& data, OZWSS::Executor::Job job, void* arg);
+void AdmitCommand(std::string const& data, OZWSS::TokenBucket& bucket);
+struct CommandBatch;
+void process_commands(std::string data, Json::Value& message, CommandBatch* batch = NULL);
 bool parse_option(int32 home, int32 node, std::string name, std::string value, bool& save, std::string& err_message);
 bool SetValue(int32 home, int32 node, std::string const value, uint8 cmdclass, std::string label, std::string& err_message);
 std::string activateScene(string sclabel);
 std::string switchAtHome();
-bool try_map_basic(int32 home, int32 node);
 void SetAlarm(std::string description, time_t alarmtime, bool offset);
-void sigalrm_handler(int sig);
+void *timer_main(void* arg);
+void run_alarm(Alarm const& currentAlarm);
 
 //-----------------------------------------------------------------------------
 // Common functions that can be used in every other function
@@ -305,41 +546,833 @@ std::string join( const std::vector<std::string>& elements, const char* const se
     }
 }
 
+//-----------------------------------------------------------------------------
+// <GetNodeTable>
+// retrieve the node table of a home, creating it when asked to
+//-----------------------------------------------------------------------------
+NodeTable* GetNodeTable(uint32 const homeId, bool create) {
+	std::map<uint32, NodeTable*>::iterator it = g_nodeTables.find(homeId);
+	if(it != g_nodeTables.end()) {
+		return it->second;
+	}
+	if(!create) {
+		return NULL;
+	}
+	NodeTable* table = new NodeTable();
+	g_nodeTables[homeId] = table;
+	return table;
+}
+
 //-----------------------------------------------------------------------------
 // <GetNodeInfo>
-// retrieve information about a node from the NodeInfo list
+// retrieve information about a node from the node registry
 //-----------------------------------------------------------------------------
 NodeInfo* GetNodeInfo(uint32 const homeId, uint8 const nodeId) {
+	if(nodeId == 0 || nodeId > MAX_NODES) {
+		return NULL;
+	}
+	if(NodeTable* table = GetNodeTable(homeId, false)) {
+		return table->slots[nodeId].info;
+	}
+
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// <AddNodeInfo>
+// register a node, it is appended to g_nodes so listings keep their order
+//-----------------------------------------------------------------------------
+bool AddNodeInfo(NodeInfo* nodeInfo) {
+	if(nodeInfo->m_nodeId == 0 || nodeInfo->m_nodeId > MAX_NODES) {
+		return false;
+	}
+	NodeSlot& slot = GetNodeTable(nodeInfo->m_homeId, true)->slots[nodeInfo->m_nodeId];
+	if(slot.info != NULL) {
+		return false;
+	}
+	slot.info = nodeInfo;
+	slot.pos = g_nodes.insert(g_nodes.end(), nodeInfo);
+	slot.dirty = true;
+	g_stateChanged = true;
+	g_changeLog.Stamp(StateEntity::Node(nodeInfo->m_homeId, nodeInfo->m_nodeId));
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// <RemoveNodeInfo>
+// unregister a node and hand it back to the caller for deletion
+//-----------------------------------------------------------------------------
+NodeInfo* RemoveNodeInfo(uint32 const homeId, uint8 const nodeId) {
+	if(nodeId == 0 || nodeId > MAX_NODES) {
+		return NULL;
+	}
+	NodeTable* table = GetNodeTable(homeId, false);
+	if(table == NULL || table->slots[nodeId].info == NULL) {
+		return NULL;
+	}
+	NodeSlot& slot = table->slots[nodeId];
+	NodeInfo* nodeInfo = slot.info;
+	g_nodes.erase(slot.pos);
+	slot.info = NULL;
+	slot.published.reset();
+	g_stateChanged = true;
+	g_changeLog.Stamp(StateEntity::Node(homeId, nodeId));
+	return nodeInfo;
+}
+
+//-----------------------------------------------------------------------------
+// <MarkNodeChanged>
+// the node will be copied into the next published snapshot
+//-----------------------------------------------------------------------------
+void MarkNodeChanged(uint32 const homeId, uint8 const nodeId) {
+	if(nodeId == 0 || nodeId > MAX_NODES) {
+		return;
+	}
+	if(NodeTable* table = GetNodeTable(homeId, false)) {
+		table->slots[nodeId].dirty = true;
+		g_stateChanged = true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <SameRooms>, <SameScenes>
+// compare the parts of rooms and scenes that are sent to clients
+//-----------------------------------------------------------------------------
+bool SameRooms(std::vector<Room> const& a, std::vector<Room> const& b) {
+	if(a.size() != b.size()) {
+		return false;
+	}
+	for(size_t i = 0; i < a.size(); ++i) {
+		if(a[i].name != b[i].name || a[i].setpoint != b[i].setpoint || a[i].currentTemp != b[i].currentTemp) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool SameScenes(std::vector<SceneListItem> const& a, std::vector<SceneListItem> const& b) {
+	if(a.size() != b.size()) {
+		return false;
+	}
+	for(size_t i = 0; i < a.size(); ++i) {
+		if(a[i].name != b[i].name || a[i].active != b[i].active) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// <PublishState>
+// build a new snapshot from our state and swap it in for the readers
+// must be called with g_criticalSection held
+//-----------------------------------------------------------------------------
+void PublishState() {
+	std::shared_ptr<StateSnapshot> snapshot = std::make_shared<StateSnapshot>();
+	snapshot->nodes.reserve(g_nodes.size());
 	for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
-		NodeInfo* nodeInfo = *it;
-		if((nodeInfo->m_homeId == homeId) && (nodeInfo->m_nodeId == nodeId)) {
-			return nodeInfo;
+		NodeSlot& slot = GetNodeTable((*it)->m_homeId, false)->slots[(*it)->m_nodeId];
+		if(slot.dirty || !slot.published) {
+			slot.published = std::make_shared<const NodeInfo>(*slot.info);
+			slot.dirty = false;
 		}
+		snapshot->nodes.push_back(slot.published);
+	}
+	snapshot->rooms.assign(roomList.begin(), roomList.end());
+	snapshot->scenes.assign(sceneList.begin(), sceneList.end());
+
+	// rooms and scenes keep their version while they do not change, so
+	// responses built from them stay valid
+	std::shared_ptr<const StateSnapshot> previous = std::atomic_load(&g_snapshot);
+	if(!previous || !SameRooms(previous->rooms, snapshot->rooms)) {
+		++g_roomsVersion;
+	}
+	if(!previous || !SameScenes(previous->scenes, snapshot->scenes)) {
+		++g_scenesVersion;
 	}
+	snapshot->roomsVersion = g_roomsVersion;
+	snapshot->scenesVersion = g_scenesVersion;
+	snapshot->version = ++g_snapshotVersion;
+	g_stateChanged = false;
+	std::atomic_store(&g_snapshot, std::shared_ptr<const StateSnapshot>(snapshot));
+}
 
-	return NULL;
+//-----------------------------------------------------------------------------
+// <GetSnapshot>
+// the last published snapshot, it stays valid for as long as the caller holds it
+//-----------------------------------------------------------------------------
+std::shared_ptr<const StateSnapshot> GetSnapshot() {
+	return std::atomic_load(&g_snapshot);
 }
 
-NodeInfo* GetNodeInfo(Notification const* notification) {
+NodeInfo* GetNodeInfo(NotificationEvent const* notification) {
 	uint32 const homeId = notification->GetHomeId();
 	uint8 const nodeId = notification->GetNodeId();
 	return GetNodeInfo(homeId, nodeId);
 }
 
+//-----------------------------------------------------------------------------
+// <GetMappedValues>
+// the values of a node in the command class its basic commands map to, for
+// SWITCH_MULTILEVEL only the first one. Returns false for an unknown node.
+//-----------------------------------------------------------------------------
+bool GetMappedValues(uint32 const homeId, int32 const nodeId, std::vector<ValueID>& values) {
+	if(nodeId <= 0 || nodeId > MAX_NODES) {
+		return false;
+	}
+	pthread_mutex_lock(&g_criticalSection);
+	NodeInfo* nodeInfo = GetNodeInfo(homeId, (uint8) nodeId);
+	if(nodeInfo) {
+		uint8 cmdclass = 0;
+		if(nodeInfo->m_basicmapping > 0) {
+			cmdclass = nodeInfo->m_basicmapping;
+			std::cout << "mapped to " << (int) cmdclass << endl;
+		}
+		else {
+			cmdclass = COMMAND_CLASS_BASIC;
+			std::cout << "mapped to BASIC" << endl;
+		}
+		for(OZWSS::ValueStore::const_iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
+			if(vit->m_id.GetCommandClassId() != cmdclass) {
+				continue;
+			}
+			// It works fine, EXCEPT for MULTILEVEL, then we need to ignore all except the first one
+			if(cmdclass == COMMAND_CLASS_SWITCH_MULTILEVEL && vit->m_id.GetIndex() != 0) {
+				continue;
+			}
+			values.push_back(vit->m_id);
+		}
+	}
+	pthread_mutex_unlock(&g_criticalSection);
+	return nodeInfo != NULL;
+}
+
+//-----------------------------------------------------------------------------
+// <FindRoom>
+// retrieve a room by its name from the room index
+//-----------------------------------------------------------------------------
+Room* FindRoom(std::string const& name) {
+	std::map<std::string, list<Room>::iterator>::iterator it = roomIndex.find(name);
+	if(it == roomIndex.end()) {
+		return NULL;
+	}
+	return &(*it->second);
+}
+
+//-----------------------------------------------------------------------------
+// <SetMembership>
+// add a node id to or remove it from one of the member lists of a room
+//-----------------------------------------------------------------------------
+void SetMembership(std::vector<uint8>& members, uint8 const nodeId, bool member) {
+	std::vector<uint8>::iterator it = std::find(members.begin(), members.end(), nodeId);
+	if(member && it == members.end()) {
+		members.push_back(nodeId);
+	}
+	else if(!member && it != members.end()) {
+		members.erase(it);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <IndexRoomMember>
+// register a node with the room of its location, as thermostat and/or
+// temperature sensor depending on its roles
+//-----------------------------------------------------------------------------
+void IndexRoomMember(NodeInfo* nodeInfo) {
+	Room* room = FindRoom(nodeInfo->m_location);
+	if(room == NULL) {
+		return;
+	}
+	SetMembership(room->members, nodeInfo->m_nodeId, true);
+	SetMembership(room->thermostats, nodeInfo->m_nodeId, (nodeInfo->m_roles & NODE_ROLE_THERMOSTAT) != 0);
+	SetMembership(room->sensors, nodeInfo->m_nodeId, (nodeInfo->m_roles & NODE_ROLE_TEMPERATURE_SENSOR) != 0);
+}
+
+//-----------------------------------------------------------------------------
+// <GetRoomReadings>
+// read the heating setpoint and temperature a node reports for its room,
+// readings the node does not have are left untouched
+//-----------------------------------------------------------------------------
+bool GetRoomReadings(NodeInfo* nodeInfo, float& setpoint, float& temperature) {
+	for(OZWSS::ValueStore::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
+		if((nodeInfo->m_roles & NODE_ROLE_THERMOSTAT) && vit->m_tag == Heating_1) {
+			if(!vit->AsFloat(setpoint)) {
+				return false;
+			}
+		}
+		else if(vit->m_tag == Temperature) {
+			if(!vit->AsFloat(temperature)) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// <AddRoomMember>
+// add a node to the room of its location, creating the room if needed
+//-----------------------------------------------------------------------------
+bool AddRoomMember(NodeInfo* nodeInfo) {
+	std::string const& location = nodeInfo->m_location;
+	if(location.empty()) {
+		return true;
+	}
+
+	float currentSetpoint=0.0;
+	float currentTemp=0.0;
+	if(!GetRoomReadings(nodeInfo, currentSetpoint, currentTemp)) {
+		return false;
+	}
+
+	if(Room* room = FindRoom(location)) {
+		if(currentSetpoint!=0.0) {
+			room->setpoint = currentSetpoint;
+		}
+		if(currentTemp!=0.0) {
+			room->currentTemp = currentTemp;
+		}
+	}
+	else {
+		Room newroom;
+		newroom.name = location;
+		newroom.setpoint = currentSetpoint;
+		newroom.currentTemp = currentTemp;
+		newroom.changed = false;
+		roomIndex[location] = roomList.insert(roomList.end(), newroom);
+	}
+	IndexRoomMember(nodeInfo);
+	g_changeLog.Stamp(StateEntity::Room(location));
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// <DropRoomMember>
+// remove a node from the room at location. An empty room is removed, otherwise
+// the readings are taken again from the remaining members if the node
+// contributed to them.
+//-----------------------------------------------------------------------------
+void DropRoomMember(NodeInfo* nodeInfo, std::string const& location) {
+	std::map<std::string, list<Room>::iterator>::iterator it = roomIndex.find(location);
+	if(it == roomIndex.end()) {
+		return;
+	}
+	Room& room = *it->second;
+	SetMembership(room.members, nodeInfo->m_nodeId, false);
+	SetMembership(room.thermostats, nodeInfo->m_nodeId, false);
+	SetMembership(room.sensors, nodeInfo->m_nodeId, false);
+	g_changeLog.Stamp(StateEntity::Room(location));
+
+	if(room.members.empty()) {
+		roomList.erase(it->second);
+		roomIndex.erase(it);
+		return;
+	}
+	if(!(nodeInfo->m_roles & (NODE_ROLE_THERMOSTAT | NODE_ROLE_TEMPERATURE_SENSOR))) {
+		return;
+	}
+	float currentSetpoint=0.0;
+	float currentTemp=0.0;
+	for(std::vector<uint8>::iterator mit = room.members.begin(); mit != room.members.end(); ++mit) {
+		if(NodeInfo* member = GetNodeInfo(nodeInfo->m_homeId, *mit)) {
+			float setpoint=0.0;
+			float temperature=0.0;
+			GetRoomReadings(member, setpoint, temperature);
+			if(setpoint!=0.0) {
+				currentSetpoint = setpoint;
+			}
+			if(temperature!=0.0) {
+				currentTemp = temperature;
+			}
+		}
+	}
+	if(!room.changed) {
+		room.setpoint = currentSetpoint;
+	}
+	room.currentTemp = currentTemp;
+}
+
+//-----------------------------------------------------------------------------
+// <MoveRoomMember>
+// a node changed location, move it from the room at previousLocation to the
+// room of its current location. Other rooms are left alone.
+//-----------------------------------------------------------------------------
+bool MoveRoomMember(NodeInfo* nodeInfo, std::string const& previousLocation) {
+	if(nodeInfo->m_location == previousLocation) {
+		return true;
+	}
+	DropRoomMember(nodeInfo, previousLocation);
+	return AddRoomMember(nodeInfo);
+}
+
+//-----------------------------------------------------------------------------
+// <QueueValueChange>, <QueueRoomChange>, <QueueSceneListChange>,
+// <QueueAtHomeChange>, <QueueStructureChange>
+// remember what changed for the next CHANGES message and give it the next
+// version of the state, call with the lock held
+//-----------------------------------------------------------------------------
+uint64 NowMs() {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+void NoteChange(ChangeClasses changeClass) {
+	pthread_mutex_lock(&g_alarmLock);
+	g_debouncer.Change(changeClass, NowMs());
+	pthread_cond_signal(&g_alarmCond);
+	pthread_mutex_unlock(&g_alarmLock);
+}
+
+void QueueValueChange(uint32 const homeId, ValueID const& valueId) {
+	g_pendingChanges.values[std::make_pair(homeId, valueId.GetId())] = time(NULL);
+	g_changeLog.Stamp(StateEntity::Value(homeId, valueId.GetId()));
+	NoteChange(ValueChanges);
+}
+
+void QueueRoomChange(std::string const& name) {
+	g_pendingChanges.rooms.insert(name);
+	g_changeLog.Stamp(StateEntity::Room(name));
+	NoteChange(RoomChanges);
+}
+
+void QueueSceneListChange() {
+	g_pendingChanges.scenes = true;
+	g_changeLog.Stamp(StateEntity::Scenes());
+	NoteChange(SceneChanges);
+}
+
+void QueueAtHomeChange() {
+	g_pendingChanges.atHome = true;
+	g_changeLog.Stamp(StateEntity::AtHome());
+	NoteChange(SceneChanges);
+}
+
+void QueueStructureChange() {
+	g_pendingChanges.structure = true;
+	NoteChange(StructureChanges);
+}
+
+//-----------------------------------------------------------------------------
+// <RoomToJson>
+// a room as it is sent in ROOMLIST, ROOM and CHANGES messages
+//-----------------------------------------------------------------------------
+Json::Value RoomToJson(Room const& room) {
+	Json::Value json;
+	json["Name"] = room.name;
+	json["currentSetpoint"] = room.setpoint;
+	stringstream ssCurrentTemp;
+	ssCurrentTemp << room.currentTemp;
+	json["currentTemp"] = ssCurrentTemp.str();
+	return json;
+}
+
+//-----------------------------------------------------------------------------
+// <RoomListToJson>
+// the rooms as they are sent in ROOMLIST messages
+//-----------------------------------------------------------------------------
+Json::Value RoomListToJson(std::vector<Room> const& rooms) {
+	Json::Value json(Json::arrayValue);
+	for(std::vector<Room>::const_iterator rit=rooms.begin(); rit!=rooms.end(); ++rit) {
+		json.append(RoomToJson(*rit));
+	}
+	return json;
+}
+
+//-----------------------------------------------------------------------------
+// <SceneListToJson>
+// the scenes as they are sent in SCENELIST and CHANGES messages
+//-----------------------------------------------------------------------------
+Json::Value SceneListToJson(std::vector<SceneListItem> const& scenes) {
+	Json::Value json(Json::arrayValue);
+	for(std::vector<SceneListItem>::const_iterator sliit=scenes.begin(); sliit!=scenes.end(); ++sliit) {
+		Json::Value scene;
+		scene["Name"] = sliit->name;
+		scene["Active"] = sliit->active;
+		json.append(scene);
+	}
+	return json;
+}
+
+//-----------------------------------------------------------------------------
+// <TopicNode>, <TopicLocation>, <TopicClass>
+// the names of the topics websocket clients can subscribe to
+//-----------------------------------------------------------------------------
+std::string TopicNode(int nodeId) {
+	stringstream ss;
+	ss << "node=" << nodeId;
+	return ss.str();
+}
+
+std::string TopicLocation(std::string const& location) {
+	return "location=" + location;
+}
+
+std::string TopicClass(int commandClass) {
+	stringstream ss;
+	ss << "class=" << commandClass;
+	return ss.str();
+}
+
+#define TOPIC_SCENES "scenes"
+#define TOPIC_ALL "*"
+
+//-----------------------------------------------------------------------------
+// <ValueToJson>
+// a value as it is sent in CHANGES and SYNC messages
+//-----------------------------------------------------------------------------
+Json::Value ValueToJson(NodeInfo const* nodeInfo, OZWSS::ValueInfo const* valueInfo) {
+	stringstream ssValueId;
+	ssValueId << valueInfo->m_id.GetId();
+	Json::Value json;
+	json["node"] = nodeInfo->m_nodeId;
+	json["valueid"] = ssValueId.str();
+	json["label"] = valueInfo->m_label;
+	json["value"] = valueInfo->m_string;
+	json["units"] = valueInfo->m_units;
+	return json;
+}
+
+//-----------------------------------------------------------------------------
+// <NodeToJson>
+// a node as it is sent in ALIST and SYNC messages
+//-----------------------------------------------------------------------------
+Json::Value NodeToJson(NodeInfo const* nodeInfo) {
+	Json::Value node;
+	node["Name"] = nodeInfo->m_name.empty() ? "Undefined" : nodeInfo->m_name;
+	node["ID"] = nodeInfo->m_nodeId;
+	node["Location"] = nodeInfo->m_location;
+	node["Type"] = nodeInfo->m_type;
+	node["Manufacturer"] = nodeInfo->m_manufacturerName;
+	node["ProductName"] = nodeInfo->m_productName;
+	node["ProductId"] = nodeInfo->m_productId;
+
+	for(OZWSS::ValueStore::const_iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
+		node["Values"][vit->m_label] = vit->m_string;
+	}
+	stringstream ssNodeLastSeen;
+	char buffer[256];
+	struct tm timeinfo;
+	localtime_r(&(nodeInfo->m_LastSeen), &timeinfo);
+	if(strftime(buffer, 256, "%a %d %b %R", &timeinfo) != 0)
+	{
+		ssNodeLastSeen << buffer;
+	}
+	else {
+		ssNodeLastSeen << trim(ctime(&(nodeInfo->m_LastSeen)));
+	}
+	node["LastSeen"] = ssNodeLastSeen.str();
+	return node;
+}
+
+//-----------------------------------------------------------------------------
+// <TakeValueChanges>
+// the values part of TakeChanges, call with the lock held
+//-----------------------------------------------------------------------------
+void TakeValueChanges(ChangeSet& changes) {
+	for(std::map<std::pair<uint32, uint64>, time_t>::iterator it = g_pendingChanges.values.begin(); it != g_pendingChanges.values.end(); ++it) {
+		ValueID valueId(it->first.first, it->first.second);
+		NodeInfo* nodeInfo = GetNodeInfo(valueId.GetHomeId(), valueId.GetNodeId());
+		if(nodeInfo == NULL) {
+			continue;
+		}
+		OZWSS::ValueInfo* valueInfo = nodeInfo->m_values.Find(valueId);
+		if(valueInfo == NULL) {
+			continue;
+		}
+		Change change;
+		change.json = ValueToJson(nodeInfo, valueInfo);
+		change.json["timestamp"] = (Json::UInt) it->second;
+		change.topics.push_back(TopicNode(nodeInfo->m_nodeId));
+		change.topics.push_back(TopicClass(valueId.GetCommandClassId()));
+		if(!nodeInfo->m_location.empty()) {
+			change.topics.push_back(TopicLocation(nodeInfo->m_location));
+		}
+		changes.values.push_back(change);
+	}
+	g_pendingChanges.values.clear();
+}
+
+//-----------------------------------------------------------------------------
+// <TakeChanges>
+// collect what changed since the last call for the classes in the mask,
+// together with the topics every change belongs to
+// Values and rooms are taken with their current state, so a value that
+// changed several times is only sent once.
+//-----------------------------------------------------------------------------
+void TakeChanges(ChangeSet& changes, uint32 classes) {
+	pthread_mutex_lock(&g_criticalSection);
+	if(classes & (1 << ValueChanges)) {
+		TakeValueChanges(changes);
+	}
+	if(classes & (1 << RoomChanges)) {
+		for(std::set<std::string>::iterator it = g_pendingChanges.rooms.begin(); it != g_pendingChanges.rooms.end(); ++it) {
+			if(Room* room = FindRoom(*it)) {
+				Change change;
+				change.json = RoomToJson(*room);
+				change.topics.push_back(TopicLocation(room->name));
+				changes.rooms.push_back(change);
+			}
+		}
+		g_pendingChanges.rooms.clear();
+	}
+	if(classes & (1 << SceneChanges)) {
+		changes.scenes = g_pendingChanges.scenes;
+		if(changes.scenes) {
+			changes.sceneList = SceneListToJson(std::vector<SceneListItem>(sceneList.begin(), sceneList.end()));
+		}
+		changes.atHome = g_pendingChanges.atHome;
+		g_pendingChanges.scenes = false;
+		g_pendingChanges.atHome = false;
+	}
+	if(classes & (1 << StructureChanges)) {
+		changes.structure = g_pendingChanges.structure;
+		g_pendingChanges.structure = false;
+	}
+	pthread_mutex_unlock(&g_criticalSection);
+}
+
+//-----------------------------------------------------------------------------
+// <ChangesToJson>
+// build a CHANGES message from the selected changes, changes are numbered
+// values first, then rooms, then the scene and at home state.
+// Without a selection all changes are taken.
+//-----------------------------------------------------------------------------
+Json::Value ChangesToJson(ChangeSet const& changes, std::set<size_t> const* selection) {
+	Json::Value message;
+	message["command"] = "CHANGES";
+	message["values"] = Json::Value(Json::arrayValue);
+	message["rooms"] = Json::Value(Json::arrayValue);
+	size_t index = 0;
+	for(std::vector<Change>::const_iterator it = changes.values.begin(); it != changes.values.end(); ++it, ++index) {
+		if(selection == NULL || selection->count(index)) {
+			message["values"].append(it->json);
+		}
+	}
+	for(std::vector<Change>::const_iterator it = changes.rooms.begin(); it != changes.rooms.end(); ++it, ++index) {
+		if(selection == NULL || selection->count(index)) {
+			message["rooms"].append(it->json);
+		}
+	}
+	if(selection == NULL || selection->count(index)) {
+		if(changes.scenes) {
+			message["scenes"] = changes.sceneList;
+		}
+		if(changes.atHome) {
+			message["athome"] = atHome;
+		}
+	}
+	return message;
+}
+
+//-----------------------------------------------------------------------------
+// <RefreshNodeInfo>
+// copy the naming and product information of a node into our cache
+//-----------------------------------------------------------------------------
+void RefreshNodeInfo(NodeInfo* nodeInfo) {
+	uint32 const homeId = nodeInfo->m_homeId;
+	uint8 const nodeId = nodeInfo->m_nodeId;
+	nodeInfo->m_name = Manager::Get()->GetNodeName(homeId, nodeId);
+	nodeInfo->m_location = Manager::Get()->GetNodeLocation(homeId, nodeId);
+	nodeInfo->m_type = Manager::Get()->GetNodeType(homeId, nodeId);
+	nodeInfo->m_manufacturerName = Manager::Get()->GetNodeManufacturerName(homeId, nodeId);
+	nodeInfo->m_productName = Manager::Get()->GetNodeProductName(homeId, nodeId);
+	nodeInfo->m_productId = Manager::Get()->GetNodeProductId(homeId, nodeId);
+}
+
+//-----------------------------------------------------------------------------
+// <RefreshValueInfo>
+// copy the current state of a value into our cache
+//-----------------------------------------------------------------------------
+void RefreshValueInfo(OZWSS::ValueInfo* valueInfo) {
+	ValueID const& vid = valueInfo->m_id;
+	valueInfo->m_units = Manager::Get()->GetValueUnits(vid);
+	valueInfo->m_valid = Manager::Get()->GetValueAsString(vid, &valueInfo->m_string);
+	switch(vid.GetType()) {
+		case ValueID::ValueType_Bool:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueAsBool(vid, &valueInfo->m_bool);
+			break;
+		case ValueID::ValueType_Byte:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueAsByte(vid, &valueInfo->m_byte);
+			break;
+		case ValueID::ValueType_Short:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueAsShort(vid, &valueInfo->m_short);
+			break;
+		case ValueID::ValueType_Int:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueAsInt(vid, &valueInfo->m_int);
+			break;
+		case ValueID::ValueType_Decimal:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueAsFloat(vid, &valueInfo->m_float);
+			break;
+		case ValueID::ValueType_List:
+			valueInfo->m_valid = valueInfo->m_valid && Manager::Get()->GetValueListSelection(vid, &valueInfo->m_int);
+			break;
+		default:
+			break;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <ValueRoles>
+// the node roles a single value implies
+//-----------------------------------------------------------------------------
+uint8 ValueRoles(OZWSS::ValueInfo const& valueInfo) {
+	uint8 roles = 0;
+	if(valueInfo.m_tag == Temperature) {
+		roles |= NODE_ROLE_TEMPERATURE_SENSOR;
+	}
+	if(valueInfo.m_id.GetCommandClassId() == COMMAND_CLASS_WAKE_UP) {
+		roles |= NODE_ROLE_WAKE_UP;
+	}
+	if(valueInfo.m_id.GetCommandClassId() == COMMAND_CLASS_CLOCK) {
+		roles |= NODE_ROLE_CLOCK;
+	}
+	return roles;
+}
+
+//-----------------------------------------------------------------------------
+// <ClassifyValue>
+// tag a newly added value and add the roles it implies to its node
+//-----------------------------------------------------------------------------
+void ClassifyValue(NodeInfo* nodeInfo, OZWSS::ValueInfo* valueInfo) {
+	std::map<std::string, ValueTags>::iterator it = s_mapStringValueTags.find(valueInfo->m_label);
+	valueInfo->m_tag = (it != s_mapStringValueTags.end()) ? it->second : Untagged;
+	uint8 roles = nodeInfo->m_roles | ValueRoles(*valueInfo);
+	if(roles != nodeInfo->m_roles) {
+		nodeInfo->m_roles = roles;
+		IndexRoomMember(nodeInfo);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <ResolveBasicMapping>
+// look up the command class the basic command class of a node maps to
+//-----------------------------------------------------------------------------
+void ResolveBasicMapping(NodeInfo* nodeInfo) {
+	uint8 generic = Manager::Get()->GetNodeGeneric(nodeInfo->m_homeId, nodeInfo->m_nodeId);
+	uint8 specific = Manager::Get()->GetNodeSpecific(nodeInfo->m_homeId, nodeInfo->m_nodeId);
+	nodeInfo->m_basicmapping = OZWSS::MapBasicCommandClass(generic, specific);
+}
+
+//-----------------------------------------------------------------------------
+// <ClassifyNode>
+// work out the roles of a node from its type and its values
+//-----------------------------------------------------------------------------
+void ClassifyNode(NodeInfo* nodeInfo) {
+	uint8 roles = 0;
+	if(nodeInfo->m_type == "Setpoint Thermostat") {
+		roles |= NODE_ROLE_THERMOSTAT;
+	}
+	for(OZWSS::ValueStore::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
+		roles |= ValueRoles(*vit);
+	}
+	if(roles != nodeInfo->m_roles) {
+		nodeInfo->m_roles = roles;
+		IndexRoomMember(nodeInfo);
+	}
+}
+
 //-----------------------------------------------------------------------------
 // <OnNotification>
 // Callback that is triggered when a value, group or node changes
+// It runs on the OpenZWave driver thread, so it only queues a copy of the
+// notification for notification_main to process
 //-----------------------------------------------------------------------------
 void OnNotification(Notification const* _notification, void* _context) {
-	// Must do this inside a critical section to avoid conflicts with the main thread
-	pthread_mutex_lock(&g_criticalSection);
+	NotificationEvent event;
+	event.type = _notification->GetType();
+	event.homeId = _notification->GetHomeId();
+	event.nodeId = _notification->GetNodeId();
+	event.valueId = _notification->GetValueID().GetId();
+	event.byte = 0;
+
+	bool valueReport = false;
+	switch(event.type) {
+		case Notification::Type_NodeEvent:
+		case Notification::Type_ControllerCommand:
+			event.byte = _notification->GetEvent();
+			break;
+		case Notification::Type_Notification:
+			event.byte = _notification->GetNotification();
+			break;
+		case Notification::Type_ValueChanged:
+		case Notification::Type_ValueRefreshed:
+			valueReport = true;
+			break;
+		default:
+			break;
+	}
+
+	// Only value reports may be dropped, losing a node or driver event would corrupt our state.
+	// Drops are counted by the queue and reported by notification_main, this
+	// thread belongs to the driver and must not block on the console.
+	g_notificationQueue->Push(event, !(g_notificationDropValues && valueReport));
+}
+
+//-----------------------------------------------------------------------------
+// <notification_main>
+// Take notifications off the queue and process them in batches of at most
+// MAX_NOTIFICATION_BATCH, letting the command threads in between batches
+//-----------------------------------------------------------------------------
+void *notification_main(void* arg) {
+	NotificationEvent event;
+	uint64 droppedReported = 0;
+	time_t dropReportTime = 0;
+	while(!stopping) {
+		uint64 dropped = g_notificationQueue->Dropped();
+		if(dropped != droppedReported && time(NULL) >= dropReportTime + NOTIFICATION_DROP_LOG_INTERVAL) {
+			std::cout << "Notification queue full, dropped " << (dropped - droppedReported) << " value reports" << endl;
+			droppedReported = dropped;
+			dropReportTime = time(NULL);
+		}
+		if(!g_notificationQueue->Pop(event, NOTIFICATION_WAIT_TIMEOUT)) {
+			continue;
+		}
+		// Must do this inside a critical section to avoid conflicts with the command threads
+		pthread_mutex_lock(&g_criticalSection);
+		int batch = 0;
+		do {
+			ProcessNotification(&event);
+			++g_notificationsProcessed;
+		} while(++batch < MAX_NOTIFICATION_BATCH && g_notificationQueue->TryPop(event));
+		if(g_stateChanged) {
+			PublishState();
+		}
+		pthread_mutex_unlock(&g_criticalSection);
+		if(batch == MAX_NOTIFICATION_BATCH) {
+			// more are waiting, give a blocked command a chance at the lock first
+			sched_yield();
+		}
+	}
+	return 0;
+}
 
+//-----------------------------------------------------------------------------
+// <ProcessNotification>
+// Update our state for a value, group or node change
+//-----------------------------------------------------------------------------
+void ProcessNotification(NotificationEvent const* _notification) {
 	switch(_notification->GetType()) {
 		case Notification::Type_ValueAdded:
 		{
 			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
 				// Add the new value to our list
-				nodeInfo->m_values.push_back( _notification->GetValueID());
+				ValueID vid = _notification->GetValueID();
+				OZWSS::ValueInfo* valueInfo = nodeInfo->m_values.Add(vid, Manager::Get()->GetValueLabel(vid));
+				ClassifyValue(nodeInfo, valueInfo);
+				RefreshValueInfo(valueInfo);
+				g_changeLog.Stamp(StateEntity::Node(nodeInfo->m_homeId, nodeInfo->m_nodeId));
+			}
+			break;
+		}
+
+		case Notification::Type_ValueRefreshed:
+		{
+			// A value was reported again without changing, keep our cache in sync
+			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
+				if(OZWSS::ValueInfo* valueInfo = nodeInfo->m_values.Find(_notification->GetValueID())) {
+					RefreshValueInfo(valueInfo);
+				}
 			}
 			break;
 		}
@@ -348,12 +1381,9 @@ void OnNotification(Notification const* _notification, void* _context) {
 		{
 			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
 				// Remove the value from out list
-				for(list<ValueID>::iterator it = nodeInfo->m_values.begin(); it != nodeInfo->m_values.end(); ++it) {
-					if((*it) == _notification->GetValueID()) {
-						nodeInfo->m_values.erase(it);
-						break;
-					}
-				}
+				nodeInfo->m_values.Remove(_notification->GetValueID());
+				ClassifyNode(nodeInfo);
+				g_changeLog.Stamp(StateEntity::Node(nodeInfo->m_homeId, nodeInfo->m_nodeId));
 			}
 			break;
 		}
@@ -364,65 +1394,46 @@ void OnNotification(Notification const* _notification, void* _context) {
 			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
 				nodeInfo->m_LastSeen = time( NULL );
 				ValueID vid = _notification->GetValueID();
-				for(list<ValueID>::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
-					if((*vit) == vid) {
-						nodeInfo->m_values.erase(vit);
-						break;
-					}
+				OZWSS::ValueInfo* valueInfo = nodeInfo->m_values.Find(vid);
+				if(valueInfo == NULL) {
+					valueInfo = nodeInfo->m_values.Add(vid, Manager::Get()->GetValueLabel(vid));
+					ClassifyValue(nodeInfo, valueInfo);
 				}
-				nodeInfo->m_values.push_back(vid);
+				RefreshValueInfo(valueInfo);
 
-				if(strcmp(Manager::Get()->GetNodeType(_notification->GetHomeId(), _notification->GetNodeId()).c_str(), "Setpoint Thermostat") == 0 && strcmp(Manager::Get()->GetValueLabel(vid).c_str(), "Heating 1") == 0) {
-					std::string location = Manager::Get()->GetNodeLocation(_notification->GetHomeId(), _notification->GetNodeId());
+				if((nodeInfo->m_roles & NODE_ROLE_THERMOSTAT) && valueInfo->m_tag == Heating_1) {
 					float currentSetpoint = 20.00;
-					if(Manager::Get()->GetValueAsFloat(vid,&currentSetpoint)) {
-						for(list<Room>::iterator rit=roomList.begin(); rit!=roomList.end(); ++rit) {
-							if(strcmp(location.c_str(), rit->name.c_str()) != 0) {
+					Room* room = FindRoom(nodeInfo->m_location);
+					if(room != NULL && valueInfo->AsFloat(currentSetpoint) && room->setpoint != currentSetpoint) {
+						room->setpoint = currentSetpoint;
+						std::cout << "Changing setpoint for room " << room->name << endl;
+						QueueRoomChange(room->name);
+
+						stringstream ssCurrentSetpoint;
+						ssCurrentSetpoint << room->setpoint;
+						for(std::vector<uint8>::iterator nit = room->thermostats.begin(); nit != room->thermostats.end(); ++nit) {
+							if(*nit == nodeInfo->m_nodeId) {
 								continue;
 							}
-							if(rit->setpoint != currentSetpoint) {
-								rit->setpoint = currentSetpoint;
-								std::cout << "Changing setpoint for room " << location << endl;
-
-								for(list<NodeInfo*>::iterator nit = g_nodes.begin(); nit != g_nodes.end(); ++nit) {
-									if(_notification->GetHomeId() == (*nit)->m_homeId && _notification->GetNodeId() == (*nit)->m_nodeId) {
-										continue;
-									}
-									if(strcmp(location.c_str(), Manager::Get()->GetNodeLocation(g_homeId, (*nit)->m_nodeId).c_str()) != 0) {
-										continue;
-									}
-									if(strcmp(Manager::Get()->GetNodeType(g_homeId, (*nit)->m_nodeId).c_str(), "Setpoint Thermostat") !=0) {
-										continue;
-									}
-									stringstream ssCurrentSetpoint;
-									ssCurrentSetpoint << rit->setpoint;
-									string err_message = "";
-									if(!SetValue(g_homeId, (*nit)->m_nodeId, ssCurrentSetpoint.str(), COMMAND_CLASS_THERMOSTAT_SETPOINT, "Heating 1", err_message)) {
-										std::cout << err_message;
-									}
-								}
+							string err_message = "";
+							if(!SetValue(g_homeId, *nit, ssCurrentSetpoint.str(), COMMAND_CLASS_THERMOSTAT_SETPOINT, "Heating 1", err_message)) {
+								std::cout << err_message;
 							}
 						}
 					}
 				}
 
-				if(strcmp(Manager::Get()->GetValueLabel(vid).c_str(), "Temperature") == 0) {
-					std::string location = Manager::Get()->GetNodeLocation(_notification->GetHomeId(), _notification->GetNodeId());
+				if(valueInfo->m_tag == Temperature) {
 					float currentTemp = 20.00;
-					if(Manager::Get()->GetValueAsFloat(vid,&currentTemp)) {
-						for(list<Room>::iterator rit=roomList.begin(); rit!=roomList.end(); ++rit) {
-							if(strcmp(location.c_str(), rit->name.c_str()) != 0) {
-								continue;
-							}
-							if(rit->currentTemp != currentTemp) {
-								rit->currentTemp = currentTemp;
-								std::cout << "Changing current temp for room " << location << endl;
-							}
-						}
+					Room* room = FindRoom(nodeInfo->m_location);
+					if(room != NULL && valueInfo->AsFloat(currentTemp) && room->currentTemp != currentTemp) {
+						room->currentTemp = currentTemp;
+						std::cout << "Changing current temp for room " << room->name << endl;
+						QueueRoomChange(room->name);
 					}
 				}
 
-				if(strcmp(Manager::Get()->GetValueLabel(vid).c_str(), "Wake-up Interval") == 0) {
+				if(valueInfo->m_tag == Wake_up_Interval_Value) {
 					stringstream key;
 					key << (int) _notification->GetHomeId() << (int) _notification->GetNodeId();
 					if(WakeupIntervalCache.count(key.str()) == 0)
@@ -433,7 +1444,7 @@ void OnNotification(Notification const* _notification, void* _context) {
 					{
 						WakeupIntervalCacheItem cacheItem = WakeupIntervalCache[key.str()];
 						int interval;
-						if(Manager::Get()->GetValueAsInt(vid,&interval) && cacheItem.interval != interval) {
+						if(valueInfo->AsInt(interval) && cacheItem.interval != interval) {
 							stringstream ssInterval;
 							ssInterval << cacheItem.interval;
 							string err_message = "";
@@ -444,7 +1455,7 @@ void OnNotification(Notification const* _notification, void* _context) {
 					}
 				}
 
-				SetAlarm("Update", SOCKET_COLLECTION_TIMEOUT, true);
+				QueueValueChange(_notification->GetHomeId(), valueInfo->m_id);
 			}
 			break;
 		}
@@ -466,22 +1477,19 @@ void OnNotification(Notification const* _notification, void* _context) {
 			nodeInfo->m_nodeId = _notification->GetNodeId();
 			nodeInfo->m_polled = false;
 			nodeInfo->m_needsSync = false;
-			g_nodes.push_back(nodeInfo);
+			nodeInfo->m_roles = 0;
+			if(!AddNodeInfo(nodeInfo)) {
+				delete nodeInfo;
+			}
 			break;
 		}
 
 		case Notification::Type_NodeRemoved:
 		{
 			// Remove the node from our list
-			uint32 const homeId = _notification->GetHomeId();
-			uint8 const nodeId = _notification->GetNodeId();
-			for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
-				NodeInfo* nodeInfo = *it;
-				if((nodeInfo->m_homeId == homeId) && (nodeInfo->m_nodeId == nodeId)) {
-					g_nodes.erase(it);
-					delete nodeInfo;
-					break;
-				}
+			if(NodeInfo* nodeInfo = RemoveNodeInfo(_notification->GetHomeId(), _notification->GetNodeId())) {
+				DropRoomMember(nodeInfo, nodeInfo->m_location);
+				delete nodeInfo;
 			}
 
 			WakeupIntervalCache.clear();
@@ -539,29 +1547,10 @@ void OnNotification(Notification const* _notification, void* _context) {
 
 		case Notification::Type_NodeProtocolInfo:
 		{
-			char buffer[10];
-			uint32 const homeId = _notification->GetHomeId();
-			uint8 const nodeId = _notification->GetNodeId();
-			if(NodeInfo* nodeInfo = GetNodeInfo(homeId, nodeId)) {
-
-				uint8 generic = Manager::Get()->GetNodeGeneric(homeId , nodeId);
-				uint8 specific = Manager::Get()->GetNodeSpecific(homeId, nodeId);
-
-				snprintf(buffer, 10, "0x%02X|0x%02X", generic, specific);
-				if(MapCommandClassBasic.find(buffer) != MapCommandClassBasic.end()) {
-					nodeInfo->m_basicmapping = MapCommandClassBasic[buffer];
-				}
-				else {
-					// We didn't find a Generic+Specifc in the table, now we check
-					// for Generic only
-					snprintf(buffer, 10, "0x%02X", generic);
-
-					// Check if we have a mapping in our map table
-					if(MapCommandClassBasic.find(buffer) != MapCommandClassBasic.end()) {
-						nodeInfo->m_basicmapping = MapCommandClassBasic[buffer];
-					}
-				}
-
+			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
+				RefreshNodeInfo(nodeInfo);
+				ClassifyNode(nodeInfo);
+				ResolveBasicMapping(nodeInfo);
 				nodeInfo->m_LastSeen = time(NULL);
 			}
 			break;
@@ -580,11 +1569,25 @@ void OnNotification(Notification const* _notification, void* _context) {
 				default: {
 				}
 			}
-		case Notification::Type_DriverReset:
+		case Notification::Type_DriverReset: {
+			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
+				nodeInfo->m_LastSeen = time(NULL);
+			}
+			break;
+		}
 		case Notification::Type_NodeNaming:
+		case Notification::Type_EssentialNodeQueriesComplete:
 		case Notification::Type_NodeQueriesComplete: {
 			if(NodeInfo* nodeInfo = GetNodeInfo(_notification)) {
+				std::string previousLocation = nodeInfo->m_location;
+				RefreshNodeInfo(nodeInfo);
+				if(_notification->GetType() != Notification::Type_NodeNaming) {
+					ClassifyNode(nodeInfo);
+					ResolveBasicMapping(nodeInfo);
+				}
+				MoveRoomMember(nodeInfo, previousLocation);
 				nodeInfo->m_LastSeen = time(NULL);
+				g_changeLog.Stamp(StateEntity::Node(nodeInfo->m_homeId, nodeInfo->m_nodeId));
 			}
 			break;
 		}
@@ -592,7 +1595,7 @@ void OnNotification(Notification const* _notification, void* _context) {
 		}
 	}
 
-	pthread_mutex_unlock(&g_criticalSection);
+	MarkNodeChanged(_notification->GetHomeId(), _notification->GetNodeId());
 }
 
 void OnControllerUpdate(uint8 cs) {
@@ -660,11 +1663,435 @@ static int httpCallback(	struct lws *wsi,
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+// Socket clients, the state of a connection is only used by the command of
+// it that runs on the executor, there is never more than one
+//-----------------------------------------------------------------------------
+struct SocketClient {
+	uint64				connection;
+	OZWSS::Encoding		encoding;
+	bool				authenticated;	// TCP clients and trusted unix socket clients need no AUTH
+	OZWSS::TokenBucket	radio;			// only used on the thread of g_socketServer
+
+	SocketClient(uint64 connection_) : connection(connection_), encoding(OZWSS::JsonEncoding), authenticated(false), radio(g_radioRate, g_radioBurst) {}
+};
+
+// users whose processes may use the unix socket without AUTH
+static std::set<uid_t> g_trustedUids;
+
+struct SocketCommand {
+	SocketClient*		client;
+	std::string			data;
+};
+
+//-----------------------------------------------------------------------------
+// Commands of both the websocket and the socket clients run on g_executor.
+// Commands that only read the state run in the read lane, commands that
+// talk to the Z-Wave network or change the configuration in the write lane,
+// so a slow SCENE or BATCH does not hold up the clients that only look.
+//-----------------------------------------------------------------------------
+enum CommandLanes {ReadLane = 0, WriteLane};
+
+static OZWSS::Executor* g_executor = NULL;
+static OZWSS::SocketServer* g_socketServer = NULL;
+
+//-----------------------------------------------------------------------------
+// Websocket commands, the session stays alive until its command is done
+//-----------------------------------------------------------------------------
+struct SessionCommand {
+	Session*			session;
+	std::string			data;
+};
+
 struct per_session_data__open_zwave {
-	int ringbuffer_tail;
-	bool authenticated;
+	Session* session;
+};
+
+//-----------------------------------------------------------------------------
+// <MakeFrame>
+// copy a message into a buffer lws_write can send without copying it again
+//-----------------------------------------------------------------------------
+OZWSS::FramePtr MakeFrame(std::string const& message) {
+	return OZWSS::Frame::Create(message, LWS_SEND_BUFFER_PRE_PADDING, LWS_SEND_BUFFER_POST_PADDING);
+}
+
+OZWSS::FramePtr MakeFrame(Json::Value const& message, OZWSS::Encoding encoding) {
+	return MakeFrame(OZWSS::Serialize(message, encoding));
+}
+
+//-----------------------------------------------------------------------------
+// Responses that only depend on the rooms or the scenes are built once per
+// version of that part of the state and encoding, and shared by everyone
+// who asks
+//-----------------------------------------------------------------------------
+struct CachedResponse {
+	pthread_mutex_t		lock;
+	uint64				version[OZWSS::NumEncodings];
+	OZWSS::FramePtr		frame[OZWSS::NumEncodings];
 };
 
+static CachedResponse g_roomListResponse = { PTHREAD_MUTEX_INITIALIZER, {}, {} };
+static CachedResponse g_sceneListResponse = { PTHREAD_MUTEX_INITIALIZER, {}, {} };
+
+//-----------------------------------------------------------------------------
+// <GetCachedResponse>
+// the shared response frame for a ROOMLIST or SCENELIST command, an empty
+// pointer for every other command
+//-----------------------------------------------------------------------------
+OZWSS::FramePtr GetCachedResponse(std::string const& data, OZWSS::Encoding encoding) {
+	std::string command = trim(data);
+	CachedResponse* cache = NULL;
+	if(command == "ROOMLIST") {
+		cache = &g_roomListResponse;
+	}
+	else if(command == "SCENELIST") {
+		cache = &g_sceneListResponse;
+	}
+	else {
+		return OZWSS::FramePtr();
+	}
+
+	std::shared_ptr<const StateSnapshot> snapshot = GetSnapshot();
+	uint64 version = (cache == &g_roomListResponse) ? snapshot->roomsVersion : snapshot->scenesVersion;
+
+	pthread_mutex_lock(&cache->lock);
+	if(!cache->frame[encoding] || cache->version[encoding] != version) {
+		Json::Value message;
+		message["command"] = command;
+		if(cache == &g_roomListResponse) {
+			message["rooms"] = RoomListToJson(snapshot->rooms);
+		}
+		else {
+			message["scenes"] = SceneListToJson(snapshot->scenes);
+		}
+		cache->frame[encoding] = MakeFrame(message, encoding);
+		cache->version[encoding] = version;
+	}
+	OZWSS::FramePtr frame = cache->frame[encoding];
+	pthread_mutex_unlock(&cache->lock);
+	return frame;
+}
+
+//-----------------------------------------------------------------------------
+// <QueueToSession>
+// queue a message for a session, marks the session for closing when its
+// slow consumer policy says so. Call with g_sessionLock held.
+//-----------------------------------------------------------------------------
+void QueueToSession(Session* session, OZWSS::FramePtr const& frame, bool change) {
+	if(!session->queue.Push(frame, change)) {
+		std::cout << "Websocket session " << session->id << " does not keep up, disconnecting" << endl;
+		session->closing = true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <WakeWebsockets>
+// let the websocket service loop write what was queued for the sessions.
+// Can be called from any thread, also before the websocket server started.
+//-----------------------------------------------------------------------------
+void WakeWebsockets() {
+	g_broadcastPending = true;
+	struct lws_context* running = context.load();
+	if(!stopping && running != NULL) {
+		lws_cancel_service(running);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <BroadcastChanges>
+// queue the changes for the sessions interested in them and wake up the
+// websocket service loop to send them. Can be called from any thread.
+// Sessions without subscriptions share one message with all changes,
+// subscribed sessions that selected the same changes share one as well.
+// Each message is built once and serialized once per encoding in use.
+//-----------------------------------------------------------------------------
+void BroadcastChanges(ChangeSet const& changes) {
+	pthread_mutex_lock(&g_sessionLock);
+	if(changes.HasChanges()) {
+		std::map<std::string, std::set<Session*> >::iterator iit = g_interest.find(TOPIC_ALL);
+		if(iit != g_interest.end()) {
+			Json::Value message = ChangesToJson(changes, NULL);
+			OZWSS::FramePtr frames[OZWSS::NumEncodings];
+			for(std::set<Session*>::iterator sit = iit->second.begin(); sit != iit->second.end(); ++sit) {
+				if((*sit)->authenticated && !(*sit)->closing) {
+					OZWSS::FramePtr& frame = frames[(*sit)->encoding];
+					if(!frame) {
+						frame = MakeFrame(message, (*sit)->encoding);
+					}
+					QueueToSession(*sit, frame, true);
+				}
+			}
+		}
+
+		std::map<Session*, std::set<size_t> > selections;
+		std::vector<std::vector<std::string> const*> topics;
+		for(std::vector<Change>::const_iterator it = changes.values.begin(); it != changes.values.end(); ++it) {
+			topics.push_back(&it->topics);
+		}
+		for(std::vector<Change>::const_iterator it = changes.rooms.begin(); it != changes.rooms.end(); ++it) {
+			topics.push_back(&it->topics);
+		}
+		for(size_t index = 0; index < topics.size(); ++index) {
+			for(std::vector<std::string>::const_iterator tit = topics[index]->begin(); tit != topics[index]->end(); ++tit) {
+				iit = g_interest.find(*tit);
+				if(iit == g_interest.end()) {
+					continue;
+				}
+				for(std::set<Session*>::iterator sit = iit->second.begin(); sit != iit->second.end(); ++sit) {
+					selections[*sit].insert(index);
+				}
+			}
+		}
+		if(changes.scenes || changes.atHome) {
+			iit = g_interest.find(TOPIC_SCENES);
+			if(iit != g_interest.end()) {
+				for(std::set<Session*>::iterator sit = iit->second.begin(); sit != iit->second.end(); ++sit) {
+					selections[*sit].insert(topics.size());
+				}
+			}
+		}
+
+		std::map<std::set<size_t>, Json::Value> messages;
+		std::map<std::pair<std::set<size_t>, OZWSS::Encoding>, OZWSS::FramePtr> frames;
+		for(std::map<Session*, std::set<size_t> >::iterator it = selections.begin(); it != selections.end(); ++it) {
+			if(!it->first->authenticated || it->first->closing) {
+				continue;
+			}
+			OZWSS::FramePtr& frame = frames[std::make_pair(it->second, it->first->encoding)];
+			if(!frame) {
+				std::map<std::set<size_t>, Json::Value>::iterator mit = messages.find(it->second);
+				if(mit == messages.end()) {
+					mit = messages.insert(std::make_pair(it->second, ChangesToJson(changes, &it->second))).first;
+				}
+				frame = MakeFrame(mit->second, it->first->encoding);
+			}
+			QueueToSession(it->first, frame, true);
+		}
+	}
+	if(changes.structure) {
+		// nodes were renamed or moved, everyone has to reload
+		Json::Value message;
+		message["command"] = "UPDATE";
+		OZWSS::FramePtr frames[OZWSS::NumEncodings];
+		for(list<Session*>::iterator it = g_sessions.begin(); it != g_sessions.end(); ++it) {
+			if((*it)->authenticated && !(*it)->closing) {
+				OZWSS::FramePtr& frame = frames[(*it)->encoding];
+				if(!frame) {
+					frame = MakeFrame(message, (*it)->encoding);
+				}
+				QueueToSession(*it, frame, true);
+			}
+		}
+	}
+	pthread_mutex_unlock(&g_sessionLock);
+	WakeWebsockets();
+}
+
+//-----------------------------------------------------------------------------
+// <SetSubscriptions>
+// SUBSCRIBE~<topic>[~<topic>...] and UNSUBSCRIBE[~<topic>...]
+// topics are node=<node id>, location=<location>, class=<command class> and
+// scenes. UNSUBSCRIBE without topics drops all subscriptions, a session
+// without subscriptions gets all changes.
+// Returns false if data is not one of these commands.
+//-----------------------------------------------------------------------------
+bool SetSubscriptions(Session* session, std::string const& data, Json::Value& message) {
+	vector<string> v;
+	split(data, "~", v);
+	std::string command = trim(v[0]);
+	bool subscribe = (command == "SUBSCRIBE");
+	if(!subscribe && command != "UNSUBSCRIBE") {
+		return false;
+	}
+	message["command"] = command;
+	if(subscribe && v.size() < 2) {
+		throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+	}
+
+	std::vector<std::string> topics;
+	for(size_t i = 1; i < v.size(); ++i) {
+		std::string topic = trim(v[i]);
+		std::size_t found = topic.find('=');
+		std::string name = topic.substr(0, found);
+		if(topic == TOPIC_SCENES) {
+			topics.push_back(topic);
+		}
+		else if(found != std::string::npos && name == "node") {
+			topics.push_back(TopicNode(lexical_cast<int>(topic.substr(found+1))));
+		}
+		else if(found != std::string::npos && name == "location") {
+			topics.push_back(TopicLocation(topic.substr(found+1)));
+		}
+		else if(found != std::string::npos && name == "class") {
+			topics.push_back(TopicClass(strtol(topic.substr(found+1).c_str(), NULL, 0)));
+		}
+		else {
+			throw OZWSS::ProtocolException("Unknown topic " + topic, 1);
+		}
+	}
+
+	pthread_mutex_lock(&g_sessionLock);
+	if(session->gone) {
+		pthread_mutex_unlock(&g_sessionLock);
+		return true;
+	}
+	if(!subscribe && topics.empty()) {
+		topics.assign(session->topics.begin(), session->topics.end());
+	}
+	for(std::vector<std::string>::iterator it = topics.begin(); it != topics.end(); ++it) {
+		if(subscribe) {
+			session->topics.insert(*it);
+			g_interest[*it].insert(session);
+		}
+		else {
+			session->topics.erase(*it);
+			g_interest[*it].erase(session);
+			if(g_interest[*it].empty()) {
+				g_interest.erase(*it);
+			}
+		}
+	}
+	if(session->topics.empty()) {
+		g_interest[TOPIC_ALL].insert(session);
+	}
+	else {
+		g_interest[TOPIC_ALL].erase(session);
+	}
+	message["topics"] = Json::Value(Json::arrayValue);
+	for(std::set<std::string>::iterator it = session->topics.begin(); it != session->topics.end(); ++it) {
+		message["topics"].append(*it);
+	}
+	pthread_mutex_unlock(&g_sessionLock);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// <SetError>
+// the error entry of the response to a command that failed, a client that
+// was told the server is busy gets the time to wait before it tries again
+//-----------------------------------------------------------------------------
+void SetError(Json::Value& message, OZWSS::ProtocolException& e) {
+	message["error"]["err_main"] = "ProtocolException";
+	message["error"]["err_message"] = e.what();
+	if(OZWSS::BusyException* busy = dynamic_cast<OZWSS::BusyException*>(&e)) {
+		message["error"]["retry_after_ms"] = (Json::UInt64) busy->RetryAfter();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <ServerBusy>
+// the error for a command that does not fit in the executor
+//-----------------------------------------------------------------------------
+OZWSS::BusyException ServerBusy() {
+	return OZWSS::BusyException("Server is busy", EXECUTOR_RETRY_MS);
+}
+
+//-----------------------------------------------------------------------------
+// <QueueError>
+// answer a websocket command that was not run, called with g_sessionLock held
+//-----------------------------------------------------------------------------
+void QueueError(Session* session, OZWSS::ProtocolException& e) {
+	if(!session->authenticated) {
+		return;
+	}
+	Json::Value message;
+	SetError(message, e);
+	QueueToSession(session, MakeFrame(message, session->encoding), false);
+}
+
+//-----------------------------------------------------------------------------
+// <DispatchSessionCommand>
+// hand the next command of a session to the executor, unless one of its
+// commands is running already. Called with g_sessionLock held.
+//-----------------------------------------------------------------------------
+void DispatchSessionCommand(Session* session) {
+	while(!session->busy && !session->commands.empty()) {
+		SessionCommand* command = new SessionCommand();
+		command->session = session;
+		command->data = session->commands.front();
+		session->commands.pop_front();
+		try {
+			AdmitCommand(command->data, session->radio);
+		}
+		catch (OZWSS::BusyException& e) {
+			std::cout << "Websocket session " << session->id << " rejected: " << command->data << ": " << e.what() << endl;
+			++session->throttled;
+			delete command;
+			QueueError(session, e);
+			continue;
+		}
+		if(SubmitCommand(command->data, run_session, command)) {
+			session->busy = true;
+			return;
+		}
+		std::cout << "Executor is full, rejected websocket command: " << command->data << endl;
+		delete command;
+		OZWSS::BusyException e = ServerBusy();
+		QueueError(session, e);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// run_session
+// Run one command of a websocket session on the executor, queue the
+// response and start the next command of the session
+//-----------------------------------------------------------------------------
+void *run_session(void* arg) {
+	SessionCommand* command = (SessionCommand*) arg;
+	Session* session = command->session;
+	std::string const& data = command->data;
+
+	pthread_mutex_lock(&g_sessionLock);
+	bool authenticated = session->authenticated;
+	bool gone = session->gone;
+	pthread_mutex_unlock(&g_sessionLock);
+
+	OZWSS::FramePtr response;
+	bool authenticating = false;
+	if(!gone && authenticated) {
+		response = GetCachedResponse(data, session->encoding);
+	}
+	if(!gone && !response) {
+		Json::Value message;
+		try {
+			// subscriptions belong to the session, handle them here
+			bool handled = authenticated && SetSubscriptions(session, data, message);
+			if(!handled && (authenticated || data.compare(0,4,"AUTH") == 0))
+				process_commands(data, message);
+		}
+		catch (OZWSS::ProtocolException& e) {
+			SetError(message, e);
+		}
+		catch (std::exception const& e) {
+			std::cout << "Exception: " << e.what() << endl;
+		}
+		authenticating = data.compare(0,4,"AUTH") == 0 && message["auth"] == true;
+		if(authenticated || authenticating) {
+			response = MakeFrame(message, session->encoding);
+		}
+	}
+
+	pthread_mutex_lock(&g_sessionLock);
+	session->busy = false;
+	if(session->gone) {
+		pthread_mutex_unlock(&g_sessionLock);
+		delete session;
+		delete command;
+		return 0;
+	}
+	if(authenticating) {
+		session->authenticated = true;
+	}
+	if(response) {
+		QueueToSession(session, response, false);
+	}
+	DispatchSessionCommand(session);
+	pthread_mutex_unlock(&g_sessionLock);
+	WakeWebsockets();
+	delete command;
+	return 0;
+}
+
 static int open_zwaveCallback(	struct lws *wsi,
 								enum lws_callback_reasons reason,
 								void *user, void *in, size_t len) {
@@ -674,100 +2101,119 @@ static int open_zwaveCallback(	struct lws *wsi,
 	// reason for callback
 	switch(reason) {
 		case LWS_CALLBACK_ESTABLISHED: {
-			pss->ringbuffer_tail = ringbuffer_head;
-			pss->authenticated = false;
+			int maxMessages = 64, maxBytes = 1048576;
+			std::string slowConsumer = "drop_oldest";
+			conf->GetWebsocketQueue(maxMessages, maxBytes, slowConsumer);
+			OZWSS::SlowConsumerPolicy policy = OZWSS::DropOldest;
+			if(slowConsumer == "coalesce") {
+				policy = OZWSS::Coalesce;
+			}
+			else if(slowConsumer == "disconnect") {
+				policy = OZWSS::Disconnect;
+			}
+			OZWSS::Encoding encoding = OZWSS::JsonEncoding;
+			if(strcmp(lws_get_protocol(wsi)->name, "open-zwave-cbor") == 0) {
+				encoding = OZWSS::CborEncoding;
+			}
+			Json::Value resync;
+			resync["command"] = "UPDATE";
+
+			pss->session = new Session(wsi, encoding, OZWSS::SendQueue(maxMessages, maxBytes, policy, MakeFrame(resync, encoding)), OZWSS::TokenBucket(g_radioRate, g_radioBurst));
+			if(g_deflate) {
+				stringstream ssLevel;
+				ssLevel << g_deflateLevel;
+				lws_set_extension_option(wsi, "permessage-deflate", "compression_level", ssLevel.str().c_str());
+			}
+			pthread_mutex_lock(&g_sessionLock);
+			pss->session->id = ++g_sessionCount;
+			g_sessions.push_back(pss->session);
+			g_interest[TOPIC_ALL].insert(pss->session);
+			pthread_mutex_unlock(&g_sessionLock);
 			std::cout << "WebSocket connection established" << endl;
 			break;
 		}
 		case LWS_CALLBACK_RECEIVE: {
+			Session* session = pss->session;
+			std::string data((char const*) in, len);
 			// log what we recieved.
-			printf("Received websocket data: %s\n", (char*) in);
-
-			std::string data = (char*) in;
-			Json::Value message;
-
-			try {
-				if(pss->authenticated || data.compare(0,4,"AUTH") == 0)
-					process_commands(data, message);
-			}
-			catch (OZWSS::ProtocolException& e) {
-				message["error"]["err_main"] = "ProtocolException";
-				message["error"]["err_message"] = e.what();
-			}
-			catch (std::exception const& e) {
-				std::cout << "Exception: " << e.what() << endl;
-			}
-
-			if(data.compare(0,4,"AUTH") == 0 && message["auth"] == true) {
-				pss->authenticated = true;
-			}
-
-			std::string response;
-			Json::FastWriter fastWriter;
-			response = fastWriter.write(message);
-
-			//put the response in the writebuffer
-			LWSMessage lwsresponse;
-			lwsresponse.message = response;
-			lwsresponse.broadcast = false;
-			lwsresponse.wsi = wsi;
-
-			ringbuffer[ringbuffer_head] = lwsresponse;
-			if (ringbuffer_head == (MAX_MESSAGE_QUEUE - 1)) {
-				ringbuffer_head = 0;
+			printf("Received websocket data: %s\n", data.c_str());
+
+			// the command runs on the executor, its response is queued when it is done
+			pthread_mutex_lock(&g_sessionLock);
+			if(session->commands.size() >= MAX_SESSION_COMMANDS) {
+				std::cout << "Websocket session " << session->id << " has too many commands waiting, rejected: " << data << endl;
+				OZWSS::BusyException e = ServerBusy();
+				QueueError(session, e);
 			}
 			else {
-				ringbuffer_head++;
+				session->commands.push_back(data);
+				DispatchSessionCommand(session);
 			}
+			pthread_mutex_unlock(&g_sessionLock);
 
-			lws_callback_on_writable_all_protocol(lws_get_context(wsi), lws_get_protocol(wsi));
+			lws_callback_on_writable(wsi);
 			break;
 		}
 		case LWS_CALLBACK_SERVER_WRITEABLE: {
-			while (pss->ringbuffer_tail != ringbuffer_head) {
-				LWSMessage lwsmessage = ringbuffer[pss->ringbuffer_tail];
-				if(pss->authenticated && (lwsmessage.broadcast || (lwsmessage.wsi == wsi))) {
-					char buf[LWS_SEND_BUFFER_PRE_PADDING + lwsmessage.message.length() + LWS_SEND_BUFFER_POST_PADDING];
-
-					memcpy(&buf[LWS_SEND_BUFFER_PRE_PADDING], lwsmessage.message.c_str(),
-						   lwsmessage.message.length());
-
-					n = lws_write(wsi,
-						(unsigned char *) &buf[LWS_SEND_BUFFER_PRE_PADDING],
-						lwsmessage.message.length(),
-						LWS_WRITE_TEXT);
-					if (n < 0) {
-						lwsl_err("ERROR %d writing to mirror socket\n", n);
-						return -1;
-					}
-					if (n < lwsmessage.message.length()) {
-						lwsl_err("mirror partial write %d vs %d\n",
-							n, lwsmessage.message.length());
-					}
+			Session* session = pss->session;
+			// lws keeps what the socket did not take and sends it before
+			// anything else, wait for that to drain before the next frame
+			while (!lws_partial_buffered(wsi)) {
+				pthread_mutex_lock(&g_sessionLock);
+				bool closing = session->closing;
+				OZWSS::FramePtr frame = session->queue.Next();
+				pthread_mutex_unlock(&g_sessionLock);
+				if(closing) {
+					return -1;
+				}
+				if(!frame) {
+					break;
 				}
 
-				if (pss->ringbuffer_tail == (MAX_MESSAGE_QUEUE - 1))
-					pss->ringbuffer_tail = 0;
-				else
-					pss->ringbuffer_tail++;
+				session->deflate = g_deflate && frame->Length() >= g_deflateMinSize;
+				if(g_deflate && !session->deflate) {
+					++g_deflateSkipped;
+				}
+
+				n = lws_write(wsi, frame->Payload(), frame->Length(), session->encoding == OZWSS::CborEncoding ? LWS_WRITE_BINARY : LWS_WRITE_TEXT);
+				if (n < 0) {
+					lwsl_err("ERROR %d writing to websocket\n", n);
+					return -1;
+				}
 
-				if (((ringbuffer_head - pss->ringbuffer_tail) &
-					  (MAX_MESSAGE_QUEUE - 1)) == (MAX_MESSAGE_QUEUE - 15))
-					lws_rx_flow_allow_all_protocol(lws_get_context(wsi), lws_get_protocol(wsi));
+				pthread_mutex_lock(&g_sessionLock);
+				session->queue.Sent();
+				pthread_mutex_unlock(&g_sessionLock);
 
 				if (lws_send_pipe_choked(wsi)) {
-					lws_callback_on_writable(wsi);
 					break;
 				}
-				/*
-				 * for tests with chrome on same machine as client and
-				 * server, this is needed to stop chrome choking
-				 */
-				usleep(1);
+			}
+			if (lws_partial_buffered(wsi) || lws_send_pipe_choked(wsi)) {
+				lws_callback_on_writable(wsi);
 			}
 			break;
 		}
 		case LWS_CALLBACK_CLOSED: {
+			Session* session = pss->session;
+			pthread_mutex_lock(&g_sessionLock);
+			g_sessions.remove(session);
+			g_interest[TOPIC_ALL].erase(session);
+			for(std::set<std::string>::iterator it = session->topics.begin(); it != session->topics.end(); ++it) {
+				g_interest[*it].erase(session);
+				if(g_interest[*it].empty()) {
+					g_interest.erase(*it);
+				}
+			}
+			// a running command deletes the session when it is done
+			session->commands.clear();
+			session->gone = session->busy;
+			bool busy = session->busy;
+			pthread_mutex_unlock(&g_sessionLock);
+			if(!busy) {
+				delete session;
+			}
+			pss->session = NULL;
 			std::cout << "Websocket client closed the connection" << endl;
 			break;
 		}
@@ -780,21 +2226,67 @@ static int open_zwaveCallback(	struct lws *wsi,
 	return 0;
 }
 
-// protocol types for websockets
-static struct lws_protocols protocols[] = {
-	{
-		"http-only",
-		httpCallback,
-		0
-	},
+// protocol types for websockets
+static struct lws_protocols protocols[] = {
+	{
+		"http-only",
+		httpCallback,
+		0
+	},
+	{
+		"open-zwave",
+		open_zwaveCallback,
+		sizeof(struct per_session_data__open_zwave),
+		0
+	},
+	{
+		// the same protocol, with messages sent as binary CBOR frames
+		"open-zwave-cbor",
+		open_zwaveCallback,
+		sizeof(struct per_session_data__open_zwave),
+		0
+	},
+	{
+		NULL, NULL, 0
+	}
+};
+
+//-----------------------------------------------------------------------------
+// <deflateCallback>
+// permessage-deflate from libwebsockets, except for messages below the
+// minimum size, compressing those costs more than it saves
+// Counts the bytes that go in and come out of the compressor
+//-----------------------------------------------------------------------------
+static int deflateCallback(	struct lws_context *context,
+							const struct lws_extension *ext,
+							struct lws *wsi,
+							enum lws_extension_callback_reasons reason,
+							void *user, void *in, size_t len) {
+	if(reason == LWS_EXT_CB_PAYLOAD_TX || reason == LWS_EXT_CB_PACKET_TX_PRESEND) {
+		struct per_session_data__open_zwave *pss = (struct per_session_data__open_zwave *) lws_wsi_user(wsi);
+		if(pss == NULL || pss->session == NULL || !pss->session->deflate) {
+			return 0;
+		}
+	}
+	if(reason == LWS_EXT_CB_PAYLOAD_TX && ((struct lws_tokens *) in)->token_len > 0) {
+		++g_deflateMessages;
+		g_deflateBytesIn += ((struct lws_tokens *) in)->token_len;
+	}
+	int n = lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+	if(reason == LWS_EXT_CB_PAYLOAD_TX && n >= 0) {
+		g_deflateBytesOut += ((struct lws_tokens *) in)->token_len;
+	}
+	return n;
+}
+
+static const struct lws_extension extensions[] = {
 	{
-		"open-zwave",
-		open_zwaveCallback,
-		sizeof(struct per_session_data__open_zwave),
-		0
+		"permessage-deflate",
+		deflateCallback,
+		"permessage-deflate; client_no_context_takeover; client_max_window_bits"
 	},
 	{
-		NULL, NULL, 0
+		NULL, NULL, NULL
 	}
 };
 
@@ -841,6 +2333,10 @@ int main(int argc, char* argv[]) {
 	pthread_mutex_init(&g_criticalSection, &mutexattr);
 	pthread_mutexattr_destroy(&mutexattr);
 
+	// the notification thread tags values by their label from the first
+	// ValueAdded on, the maps are read only once the threads run
+	create_string_maps();
+
 	pthread_mutex_lock(&initMutex);
 
 	// Create the OpenZWave Manager.
@@ -853,6 +2349,41 @@ int main(int argc, char* argv[]) {
 
 	Manager::Create();
 
+	int queueSize = 1024;
+	std::string overflow = "block";
+	if(!conf->GetNotificationQueue(queueSize, overflow)) {
+		std::cout << "Invalid notification queue size in Config.ini, using " << queueSize << endl;
+	}
+	g_notificationDropValues = (overflow == "drop");
+	g_notificationQueue = new OZWSS::EventQueue<NotificationEvent>(queueSize);
+
+	pthread_t notification_thread;
+	if(pthread_create(&notification_thread, NULL, notification_main, NULL) != 0) {
+		throw std::runtime_error("Unable to create thread");
+	}
+
+	const char* changeClasses[NumChangeClasses] = {"values", "rooms", "scenes", "structure"};
+	for(int i = 0; i < NumChangeClasses; ++i) {
+		int minWindow = 250, maxWindow = 2000;
+		if(!conf->GetDebounce(changeClasses[i], minWindow, maxWindow)) {
+			std::cout << "Invalid debounce_" << changeClasses[i] << " in Config.ini, using " << minWindow << "," << maxWindow << endl;
+		}
+		g_debouncer.SetWindow(i, minWindow, maxWindow);
+	}
+
+	int changeLogSize = 4096;
+	if(!conf->GetChangeLogSize(changeLogSize)) {
+		std::cout << "Invalid change_log_size in Config.ini, using " << changeLogSize << endl;
+	}
+	pthread_mutex_lock(&g_criticalSection);
+	g_changeLog.SetCapacity(changeLogSize);
+	pthread_mutex_unlock(&g_criticalSection);
+
+	pthread_t timer_thread;
+	if(pthread_create(&timer_thread, NULL, timer_main, NULL) != 0) {
+		throw std::runtime_error("Unable to create thread");
+	}
+
 	// Add a callback handler to the manager.  The second argument is a context that
 	// is passed to the OnNotification method.  If the OnNotification is a method of
 	// a class, the context would usually be a pointer to that class object, to
@@ -871,7 +2402,7 @@ int main(int argc, char* argv[]) {
 	pthread_cond_wait(&initCond, &initMutex);
 
 	if(!g_initFailed) {
-		create_string_maps();
+		pthread_mutex_lock(&g_criticalSection);
 		if(!init_Rooms()) {
 			std::cerr << "Something went wrong configuring the Rooms";
 			return 0;
@@ -884,6 +2415,8 @@ int main(int argc, char* argv[]) {
 			std::cerr << "Something went wrong configuring the Wake-up Interval Cache";
 			return 0;
 		}
+		PublishState();
+		pthread_mutex_unlock(&g_criticalSection);
 		Manager::Get()->WriteConfig(g_homeId);
 
 		Driver::DriverData data;
@@ -894,6 +2427,25 @@ int main(int argc, char* argv[]) {
 		printf("Dropped: %d Retries: %d\n", data.m_dropped, data.m_retries);
 		printf("***************************************************** \n");
 
+		// commands of the websocket and socket clients run on the executor
+		int workers = 4, writeWorkers = 1, queueSize = 256;
+		if(!conf->GetCommandWorkers(workers, writeWorkers, queueSize)) {
+			std::cout << "Invalid command_workers, command_write_workers or command_queue_size in Config.ini, using " << workers << ", " << writeWorkers << " and " << queueSize << endl;
+		}
+		g_executor = new OZWSS::Executor(NumCommands);
+		g_executor->AddLane("read", workers, queueSize);
+		g_executor->AddLane("write", writeWorkers, queueSize);
+
+		double radioRate;
+		int radioBurst, radioQueueLimit;
+		if(conf->GetRadioRateLimit(radioRate, radioBurst)) {
+			g_radioRate = radioRate;
+			g_radioBurst = radioBurst;
+		}
+		if(conf->GetRadioSendQueueLimit(radioQueueLimit)) {
+			g_radioQueueLimit = radioQueueLimit;
+		}
+
 		//start the websocket in a new thread
 		pthread_t websocket_thread;
 		if(pthread_create(&websocket_thread , NULL ,  websockets_main ,NULL) < 0) {
@@ -909,34 +2461,35 @@ int main(int argc, char* argv[]) {
 			return 0;
 		}
 		std::cout << "Starting TCP server on port: " << tcpport << endl;
-		string host = "0.0.0.0";
-		using libsocket::inet_stream_server;
-		using libsocket::inet_stream;
-
-		inet_stream_server srv(host,tcpport,LIBSOCKET_IPv4);
-
-		while(!stopping) {
-
-			inet_stream* client = srv.accept();
-
-			pthread_t thread;
-			try {
-				if(pthread_create(&thread, NULL, run_socket, (void*) client) < 0) {
-					throw std::runtime_error("Unable to create thread");
-				}
-				else {
-					std::cout << "Socket connection established" << endl;
-				}
-			}
-			catch(...) {
-				std::cout << "Other exception" << endl;
+		OZWSS::SocketServer::Callbacks callbacks = { socket_opened, socket_received, socket_closed };
+		g_socketServer = new OZWSS::SocketServer(callbacks);
+		if(!g_socketServer->Listen("0.0.0.0", tcpport)) {
+			return 0;
+		}
+		std::string unixSocket;
+		int unixSocketMode;
+		std::vector<int> trustedUids;
+		if(conf->GetUnixSocket(unixSocket, unixSocketMode, trustedUids)) {
+			// root and the user the server runs as are always trusted
+			g_trustedUids.insert(0);
+			g_trustedUids.insert(getuid());
+			g_trustedUids.insert(trustedUids.begin(), trustedUids.end());
+			std::cout << "Starting unix socket server on: " << unixSocket << endl;
+			if(!g_socketServer->ListenUnix(unixSocket, unixSocketMode)) {
+				std::cerr << "Continuing without the unix socket" << endl;
 			}
 		}
-		srv.destroy();
+		g_socketServer->Run(stopping, "Server is stopping, closing socket connection");
+		// no new websocket commands once its thread is done, commands that are
+		// still running answer to the server, stop them before it
+		pthread_join(websocket_thread, NULL);
+		delete g_executor;
+		g_executor = NULL;
+		delete g_socketServer;
+		g_socketServer = NULL;
 	}
 
 	// program exit (clean up)
-	delete conf;
 	Manager::Get()->WriteConfig(g_homeId);
 	std::cout << "Closing connection to Zwave Controller" << endl;
 
@@ -947,6 +2500,11 @@ int main(int argc, char* argv[]) {
 		Manager::Get()->RemoveDriver(port);
 	}
 	Manager::Get()->RemoveWatcher(OnNotification, NULL);
+	stopping = true;
+	pthread_join(notification_thread, NULL);
+	pthread_join(timer_thread, NULL);
+	delete g_notificationQueue;
+	delete conf;
 	Manager::Destroy();
 	Options::Destroy();
 	pthread_mutex_destroy(&g_criticalSection);
@@ -967,50 +2525,11 @@ void sigint_handler(int sig) {
 // The roomlist is built from the devicelist information
 //-----------------------------------------------------------------------------
 bool init_Rooms() {
+	roomList.clear();
+	roomIndex.clear();
 	for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
-		std::string location = Manager::Get()->GetNodeLocation(g_homeId, (*it)->m_nodeId);
-		if(location.empty()) {
-			continue;
-		}
-
-		float currentSetpoint=0.0;
-		float currentTemp=0.0;
-		for(list<ValueID>::iterator vit = (*it)->m_values.begin(); vit != (*it)->m_values.end(); ++vit) {
-			if(strcmp(Manager::Get()->GetNodeType(g_homeId, (*it)->m_nodeId).c_str(), "Setpoint Thermostat") ==0 && strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Heating 1") == 0) {
-				if(!Manager::Get()->GetValueAsFloat(*vit, &currentSetpoint)) {
-					return false;
-				}
-			}
-			else if(strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Temperature") == 0) {
-				if(!Manager::Get()->GetValueAsFloat(*vit, &currentTemp)) {
-					return false;
-				}
-			}
-		}
-
-		Room newroom;
-		newroom.name = location;
-		newroom.setpoint = currentSetpoint;
-		newroom.currentTemp = currentTemp;
-		newroom.changed = false;
-
-		list<Room>::iterator rit;
-		for(rit = roomList.begin(); rit != roomList.end(); ++rit)
-		{
-			if((*rit)==newroom)
-				break;
-		}
-		if ( rit != roomList.end() )
-		{
-			if(currentSetpoint!=0.0) {
-				rit->setpoint = currentSetpoint;
-			}
-			if(currentTemp!=0.0) {
-				rit->currentTemp = currentTemp;
-			}
-		}
-		else {
-			roomList.push_back(newroom);
+		if(!AddRoomMember(*it)) {
+			return false;
 		}
 	}
 
@@ -1050,31 +2569,32 @@ bool init_Scenes() {
 //-----------------------------------------------------------------------------
 bool init_WakeupIntervalCache() {
 	for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
+		if(!((*it)->m_roles & NODE_ROLE_WAKE_UP)) {
+			continue;
+		}
 		int defaultInterval = 0, minInterval = 0, maxInterval = std::numeric_limits<int>::max(), interval = 0;
 		bool wake_cc_node = false;
-		for(list<ValueID>::iterator vit = (*it)->m_values.begin(); vit != (*it)->m_values.end(); ++vit) {
-			if((*vit).GetCommandClassId() != COMMAND_CLASS_WAKE_UP) {
-				continue;
-			}
+		std::vector<OZWSS::ValueInfo*> wakeupValues = (*it)->m_values.FindAll(COMMAND_CLASS_WAKE_UP);
+		for(std::vector<OZWSS::ValueInfo*>::iterator vit = wakeupValues.begin(); vit != wakeupValues.end(); ++vit) {
 			wake_cc_node = true;
-			if(strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Wake-up Interval") == 0) {
-				if(!Manager::Get()->GetValueAsInt((*vit), &interval)) {
+			if((*vit)->m_tag == Wake_up_Interval_Value) {
+				if(!(*vit)->AsInt(interval)) {
 					return false;
 				}
 				std::cout << "Interval: " << interval << endl;
 			}
-			if(strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Default Wake-up Interval") == 0) {
-				if(!Manager::Get()->GetValueAsInt((*vit), &defaultInterval)) {
+			if((*vit)->m_tag == Default_Wake_up_Interval) {
+				if(!(*vit)->AsInt(defaultInterval)) {
 					return false;
 				}
 			}
-			if(strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Minimum Wake-up Interval") == 0) {
-				if(!Manager::Get()->GetValueAsInt((*vit), &minInterval)) {
+			if((*vit)->m_tag == Minimum_Wake_up_Interval) {
+				if(!(*vit)->AsInt(minInterval)) {
 					return false;
 				}
 			}
-			if(strcmp(Manager::Get()->GetValueLabel(*vit).c_str(), "Maximum Wake-up Interval") == 0) {
-				if(!Manager::Get()->GetValueAsInt((*vit), &maxInterval)) {
+			if((*vit)->m_tag == Maximum_Wake_up_Interval) {
+				if(!(*vit)->AsInt(maxInterval)) {
 					return false;
 				}
 			}
@@ -1092,124 +2612,503 @@ bool init_WakeupIntervalCache() {
 			WakeupIntervalCache.insert(std::pair<std::string, WakeupIntervalCacheItem>(key.str(),newCacheItem));
 		}
 	}
-	return true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// websockets_main
+// Start the websocket server and keep the service thread running
+//-----------------------------------------------------------------------------
+void *websockets_main(void* arg) {
+	int port;
+	if(!conf->GetWSPort(port)) {
+		std::cerr << "There is no WS port set in Config.ini, please specify one and try again.\n";
+		return 0;
+	}
+	const char *interface = NULL;
+
+	const char *cert_path = NULL;
+	const char *key_path = NULL;
+
+	std::string certificate, certificate_key;
+	conf->GetCertificateInfo(certificate, certificate_key);
+
+	if(!certificate.empty() && !certificate_key.empty()) {
+		cert_path = certificate.c_str();
+		key_path = certificate_key.c_str();
+	}
+
+	// no special options
+	int opts = 0;
+
+	// create connection struct
+	struct lws_context_creation_info info;
+	memset(&info, 0, sizeof info);
+	info.port = port;
+	info.iface = interface;
+	info.protocols = protocols;
+	int deflateLevel, deflateMinSize;
+	if(conf->GetWebsocketDeflate(deflateLevel, deflateMinSize)) {
+		g_deflate = true;
+		g_deflateLevel = deflateLevel;
+		g_deflateMinSize = deflateMinSize > 0 ? deflateMinSize : 0;
+		info.extensions = extensions;
+	}
+	else {
+		info.extensions = NULL;
+	}
+	info.ssl_cert_filepath = cert_path;
+	info.ssl_private_key_filepath = key_path;
+	info.options = opts;
+
+	// create libwebsocket context representing this server
+	struct lws_context* server = lws_create_context(&info);
+
+	// make sure it starts
+	if(server == NULL) {
+		std::cerr << "libwebsocket init failed\n";
+		stopping = true; //notify the other threads
+		return 0;
+	}
+	context = server;
+	std::cout << "starting websocket server...\n";
+
+	// infinite loop, to end this server send SIGTERM. (CTRL+C)
+	while (!stopping) {
+		lws_service(server, 10);
+		if(g_broadcastPending.exchange(false)) {
+			lws_callback_on_writable_all_protocol(server, &protocols[1]);
+			lws_callback_on_writable_all_protocol(server, &protocols[2]);
+		}
+	}
+
+	context = NULL;
+	lws_context_destroy(server);
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// <SocketError>
+// the response of a socket connection to a command that failed
+//-----------------------------------------------------------------------------
+std::string SocketError(SocketClient* client, OZWSS::ProtocolException& e) {
+	if(client->encoding == OZWSS::JsonEncoding) {
+		return "ProtocolException: " + e.what() + "\n";
+	}
+	Json::Value message;
+	SetError(message, e);
+	return OZWSS::Serialize(message, client->encoding);
+}
+
+//-----------------------------------------------------------------------------
+// <socket_opened>, <socket_received>, <socket_closed>
+// Socket connections are served by g_socketServer on the main thread, their
+// commands are run by g_executor
+//-----------------------------------------------------------------------------
+void* socket_opened(uint64 connection, OZWSS::SocketServer::Peer const& peer) {
+	SocketClient* client = new SocketClient(connection);
+	client->authenticated = !peer.local || g_trustedUids.count(peer.uid) > 0;
+	if(peer.local) {
+		std::cout << "Unix socket connection established by pid " << peer.pid << " of uid " << (int) peer.uid << (client->authenticated ? ", trusted" : ", needs AUTH") << endl;
+	}
+	else {
+		std::cout << "Socket connection established" << endl;
+	}
+	return client;
+}
+
+void socket_received(uint64 connection, void* user, std::string const& data) {
+	SocketCommand* command = new SocketCommand();
+	command->client = (SocketClient*) user;
+	command->data = data;
+	try {
+		AdmitCommand(data, command->client->radio);
+	}
+	catch (OZWSS::BusyException& e) {
+		std::cout << "Rejected socket command: " << data << ": " << e.what() << endl;
+		g_socketServer->Reply(connection, SocketError(command->client, e));
+		delete command;
+		return;
+	}
+	if(!SubmitCommand(data, run_socket, command)) {
+		std::cout << "Executor is full, rejected socket command: " << data << endl;
+		OZWSS::ProtocolException e = ServerBusy();
+		g_socketServer->Reply(connection, SocketError(command->client, e));
+		delete command;
+	}
+}
+
+void socket_closed(uint64 connection, void* user) {
+	std::cout << "Socket client closed the connection" << endl;
+	delete (SocketClient*) user;
+}
+
+//-----------------------------------------------------------------------------
+// run_socket
+// Run one command of a socket connection on the executor and send the
+// response back through g_socketServer
+// Responses are JSON followed by a newline until the client sends
+// ENCODING~CBOR, then they are CBOR items without separator.
+//-----------------------------------------------------------------------------
+void *run_socket(void* arg) {
+	SocketCommand* command = (SocketCommand*) arg;
+	SocketClient* client = command->client;
+	std::string const& data = command->data;
+	std::string response;
+
+	try { // command parsing errors
+		std::cout << "Received socket data: " << data << endl;
+		string separator = (client->encoding == OZWSS::JsonEncoding) ? "\n" : "";
+		Json::Value message;
+		vector<string> v;
+		split(data, "~", v);
+		if(!client->authenticated && CommandOf(v[0]) != Auth) {
+			throw OZWSS::ProtocolException("Not authenticated, send AUTH first", 7);
+		}
+		if(OZWSS::FramePtr cached = GetCachedResponse(data, client->encoding)) {
+			response = std::string((char const*) cached->Payload(), cached->Length()) + separator;
+		}
+		else if(trim(v[0]) == "ENCODING") {
+			// the connection keeps its encoding, it only changes after the response
+			message["command"] = "ENCODING";
+			if(v.size() != 2) {
+				throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+			}
+			OZWSS::Encoding requested;
+			if(!OZWSS::ParseEncoding(trim(v[1]), requested)) {
+				throw OZWSS::ProtocolException("Unknown encoding " + trim(v[1]), 2);
+			}
+			message["encoding"] = OZWSS::EncodingName(requested);
+			response = OZWSS::Serialize(message, client->encoding) + separator;
+			client->encoding = requested;
+		}
+		else {
+			process_commands(data, message);
+			if(!client->authenticated && message["auth"] == true) {
+				client->authenticated = true;
+			}
+			response = OZWSS::Serialize(message, client->encoding) + separator;
+		}
+	}
+	catch (OZWSS::ProtocolException& e) {
+		response = SocketError(client, e);
+	}
+	catch (std::exception const& e) {
+		std::cout << "Exception: " << e.what() << endl;
+	}
+	g_socketServer->Reply(client->connection, response);
+	delete command;
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// <SaveConfig>
+// write the configuration of the Z-Wave network, or leave that to the end
+// of the batch
+//-----------------------------------------------------------------------------
+void SaveConfig(CommandBatch* batch) {
+	if(batch != NULL) {
+		batch->save = true;
+		return;
+	}
+	Manager::Get()->WriteConfig(g_homeId);
+}
+
+//-----------------------------------------------------------------------------
+// <CommandOf>
+// look up a command without adding unknown names to s_mapStringCommands
+//-----------------------------------------------------------------------------
+Commands CommandOf(std::string const& name) {
+	std::map<std::string, Commands>::const_iterator it = s_mapStringCommands.find(trim(name));
+	return it == s_mapStringCommands.end() ? Undefined_command : it->second;
+}
+
+//-----------------------------------------------------------------------------
+// <CommandLane>
+// the executor lane a command runs in
+//-----------------------------------------------------------------------------
+CommandLanes CommandLane(Commands command) {
+	switch(command) {
+		case Undefined_command:
+		case Auth:
+		case AList:
+		case RoomListC:
+		case SceneListC:
+		case AtHome:
+		case AlarmList:
+		case Stats:
+		case Subscribe:
+		case Unsubscribe:
+		case EncodingC:
+		case Sync:
+		case Test:
+		case Exit:
+			return ReadLane;
+		default:
+			return WriteLane;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <SubmitCommand>
+// queue the job that runs a command in its lane, the executor keeps the
+// queue wait and run time per command. Returns false when the lane is full.
+//-----------------------------------------------------------------------------
+bool SubmitCommand(std::string const& data, OZWSS::Executor::Job job, void* arg) {
+	Commands command = CommandOf(data.substr(0, data.find('~')));
+	return g_executor->Submit(CommandLane(command), command, job, arg);
+}
+
+//-----------------------------------------------------------------------------
+// <RadioCost>
+// how many commands that send to the Z-Wave network a request holds
+//-----------------------------------------------------------------------------
+unsigned RadioCost(std::string const& data) {
+	vector<string> v;
+	split(data, "~", v);
+	switch(CommandOf(v[0])) {
+		case SetNode:
+		case RoomC:
+		case Switch:
+		case ControllerC:
+		case Reset:
+			return 1;
+		case SceneC:
+			return (v.size() > 1 && CommandOf(v[1]) == Activate) ? 1 : 0;
+		case Batch:
+		{
+			Json::Value commands;
+			Json::Reader reader;
+			unsigned cost = 0;
+			if(v.size() > 1 && reader.parse(data.substr(data.find('~')+1), commands) && commands.isArray()) {
+				for(Json::ArrayIndex i = 0; i < commands.size(); ++i) {
+					if(commands[i].isString() && CommandOf(commands[i].asString().substr(0, commands[i].asString().find('~'))) != Batch) {
+						cost += RadioCost(commands[i].asString());
+					}
+				}
+			}
+			return cost;
+		}
+		default:
+			return 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <AdmitCommand>
+// decide whether a command of a client may run now. Commands that send to
+// the Z-Wave network take tokens from the bucket of the client, and are
+// refused while the controller has too many messages waiting to be sent.
+// Throws a BusyException when the client has to try again later.
+//-----------------------------------------------------------------------------
+void AdmitCommand(std::string const& data, OZWSS::TokenBucket& bucket) {
+	unsigned cost = RadioCost(data);
+	if(cost == 0) {
+		return;
+	}
+	if(g_radioQueueLimit > 0 && g_homeId != 0) {
+		int32 queued = Manager::Get()->GetSendQueueCount(g_homeId);
+		if(queued >= g_radioQueueLimit) {
+			++g_radioBusy;
+			throw OZWSS::BusyException("Z-Wave network is busy", (uint64) (queued - g_radioQueueLimit + 1) * RADIO_MESSAGE_MS);
+		}
+	}
+	uint64 wait = bucket.Take(cost, NowMs());
+	if(wait > 0) {
+		++g_radioRateLimited;
+		throw OZWSS::BusyException("Too many Z-Wave commands", wait);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// <ValidateBatchCommand>
+// check a command of a BATCH before any of them runs, so a typo halfway
+// does not leave the batch half done. Throws a ProtocolException.
+//-----------------------------------------------------------------------------
+void ValidateBatchCommand(std::string const& data) {
+	vector<string> v;
+	split(data, "~", v);
+	try {
+		switch(CommandOf(v[0])) {
+			case AList:
+			case RoomListC:
+			case SceneListC:
+			case Cron:
+			case Switch:
+			case AtHome:
+			case AlarmList:
+			case Stats:
+			case Test:
+				return;
+			case SetNode: {
+				if(v.size() != 3) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				lexical_cast<int>(v[1]);
+				vector<string> options;
+				split(trim(v[2]), "<>", options);
+				for(vector<string>::iterator it = options.begin(); it != options.end(); ++it) {
+					std::size_t found = it->find('=');
+					if(found != std::string::npos && s_mapStringOptions.find(it->substr(0, found)) == s_mapStringOptions.end()) {
+						throw OZWSS::ProtocolException("Unknown option " + it->substr(0, found), 2);
+					}
+				}
+				return;
+			}
+			case RoomC: {
+				if(v.size() != 3) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				Commands command = CommandOf(v[1]);
+				if(command != Plus && command != Minus) {
+					throw OZWSS::ProtocolException("Unknown Room command", 1);
+				}
+				return;
+			}
+			case SceneC: {
+				if(v.size() < 3) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				switch(CommandOf(v[1])) {
+					case Create:
+					case Activate:
+						return;
+					case Add:
+						if(v.size() != 5) {
+							throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+						}
+						lexical_cast<int>(v[3]);
+						lexical_cast<double>(v[4]);
+						return;
+					case Remove:
+						if(v.size() != 4) {
+							throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+						}
+						lexical_cast<int>(v[3]);
+						return;
+					default:
+						throw OZWSS::ProtocolException("Unknown Scene command", 1);
+				}
+			}
+			case ControllerC: {
+				if(v.size() < 2) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				switch(CommandOf(v[1])) {
+					case Add:
+						if(v.size() != 3) {
+							throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+						}
+						lexical_cast<bool>(v[2]);
+						return;
+					case Remove:
+					case Cancel:
+					case Reset:
+						return;
+					default:
+						throw OZWSS::ProtocolException("Unknown Controller command", 1);
+				}
+			}
+			case PollInterval:
+				if(v.size() != 2) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				lexical_cast<int>(v[1]);
+				return;
+			case Sync:
+				if(v.size() < 2 || v.size() > 3) {
+					throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+				}
+				lexical_cast<uint64>(trim(v[1]));
+				return;
+			case Auth:
+			case Subscribe:
+			case Unsubscribe:
+			case EncodingC:
+			case Batch:
+			case Exit:
+				throw OZWSS::ProtocolException(trim(v[0]) + " can not be part of a batch", 2);
+			default:
+				throw OZWSS::ProtocolException("Unknown command", 1);
+		}
+	}
+	catch (std::runtime_error const& e) {
+		if(dynamic_cast<OZWSS::ProtocolException const*>(&e) != NULL) {
+			throw;
+		}
+		throw OZWSS::ProtocolException("Invalid argument", 2);
+	}
 }
 
 //-----------------------------------------------------------------------------
-// websockets_main
-// Start the websocket server and keep the service thread running
+// <RunBatch>
+// BATCH~["<command>", "<command>", ...]
+// validate all commands, then run them one after the other while holding
+// g_criticalSection, so nothing else runs in between, and write the
+// configuration once at the end. The response has the response of every
+// command, in order; a failing command does not stop the others.
 //-----------------------------------------------------------------------------
-void *websockets_main(void* arg) {
-	int port;
-	if(!conf->GetWSPort(port)) {
-		std::cerr << "There is no WS port set in Config.ini, please specify one and try again.\n";
-		return 0;
-	}
-	const char *interface = NULL;
-
-	const char *cert_path = NULL;
-	const char *key_path = NULL;
-
-	std::string certificate, certificate_key;
-	conf->GetCertificateInfo(certificate, certificate_key);
-
-	if(!certificate.empty() && !certificate_key.empty()) {
-		cert_path = certificate.c_str();
-		key_path = certificate_key.c_str();
+void RunBatch(std::string const& data, Json::Value& message) {
+	std::string::size_type found = data.find('~');
+	Json::Value commands;
+	Json::Reader reader;
+	if(found == std::string::npos || !reader.parse(data.substr(found+1), commands) || !commands.isArray() || commands.empty()) {
+		throw OZWSS::ProtocolException("BATCH needs a JSON array of commands", 2);
 	}
-
-	// no special options
-	int opts = 0;
-
-	// create connection struct
-	struct lws_context_creation_info info;
-	memset(&info, 0, sizeof info);
-	info.port = port;
-	info.iface = interface;
-	info.protocols = protocols;
-	info.extensions = NULL;
-	info.ssl_cert_filepath = cert_path;
-	info.ssl_private_key_filepath = key_path;
-	info.options = opts;
-
-	// create libwebsocket context representing this server
-	context = lws_create_context(&info);
-
-	// make sure it starts
-	if(context == NULL) {
-		std::cerr << "libwebsocket init failed\n";
-		stopping = true; //notify the other threads
-		return 0;
+	if(commands.size() > MAX_BATCH_COMMANDS) {
+		throw OZWSS::ProtocolException("Too many commands in batch", 2);
 	}
-	std::cout << "starting websocket server...\n";
-
-	// infinite loop, to end this server send SIGTERM. (CTRL+C)
-	while (!stopping) {
-		lws_service(context, 10);
+	for(Json::ArrayIndex i = 0; i < commands.size(); ++i) {
+		stringstream ssIndex;
+		ssIndex << i;
+		if(!commands[i].isString()) {
+			throw OZWSS::ProtocolException("Command " + ssIndex.str() + " is not a string", 2);
+		}
+		try {
+			ValidateBatchCommand(commands[i].asString());
+		}
+		catch (OZWSS::ProtocolException& e) {
+			throw OZWSS::ProtocolException("Command " + ssIndex.str() + ": " + e.std::runtime_error::what(), e.Code());
+		}
 	}
 
-	lws_context_destroy(context);
-
-	return 0;
-}
-
-//-----------------------------------------------------------------------------
-// run_socket
-// Every new socket connection gets its own thread
-// This thread listens for commands on the socket connection
-//-----------------------------------------------------------------------------
-void *run_socket(void* arg) {
-	using libsocket::inet_stream;
-	inet_stream* client;
-	client = (inet_stream*) arg;
-
-	while(!stopping) {
-		try { // command parsing errors
-			//get commands from the socket
-			std::string data;
-			data.resize(1024);
-			*client >> data;
-
-			if(data.empty()) {
-				std::cout << "Socket client closed the connection" << endl;
-				client->destroy();
-				return 0;
-			}
-			std::cout << "Received socket data: " << data;
-			Json::Value message;
-			process_commands(data, message);
-			Json::FastWriter fastWriter;
-			string response = fastWriter.write(message) + "\n";
-			*client << response;
+	CommandBatch batch;
+	message["results"] = Json::Value(Json::arrayValue);
+	pthread_mutex_lock(&g_criticalSection);
+	for(Json::ArrayIndex i = 0; i < commands.size(); ++i) {
+		Json::Value result;
+		try {
+			process_commands(commands[i].asString(), result, &batch);
 		}
 		catch (OZWSS::ProtocolException& e) {
-			string what = "ProtocolException: ";
-			what += e.what();
-			what += "\n";
-			*client << what;
-		}
-		catch (libsocket::socket_exception exc) {
-			std::cerr << exc.mesg << " errno code: " << exc.err;
+			result["error"]["err_main"] = "ProtocolException";
+			result["error"]["err_message"] = e.what();
 		}
 		catch (std::exception const& e) {
-			std::cout << "Exception: " << e.what() << endl;
+			result["error"]["err_main"] = "Exception";
+			result["error"]["err_message"] = e.what();
 		}
+		message["results"].append(result);
 	}
-	std::cout << "Server is stopping, closing socket connection" << endl;
-	*client << "Server is stopping, closing socket connection";
-	client->destroy();
-	return 0;
+	pthread_mutex_unlock(&g_criticalSection);
+
+	if(batch.save) {
+		Manager::Get()->WriteConfig(g_homeId);
+	}
+	message["saved"] = batch.save;
 }
 
 //-----------------------------------------------------------------------------
 // process_commands
 // when a command comes in, parse it, execute it and send the response back
+// Within a BATCH, batch collects what has to happen when all commands ran
 //-----------------------------------------------------------------------------
-void process_commands(std::string data, Json::Value& message) {
+void process_commands(std::string data, Json::Value& message, CommandBatch* batch) {
 	vector<string> v;
 	split(data, "~", v);
 	message["command"] = trim(v[0]);
-	switch (s_mapStringCommands[trim(v[0])])
+	switch (CommandOf(v[0]))
 	{
 		case Auth:
 		{
@@ -1252,45 +3151,9 @@ void process_commands(std::string data, Json::Value& message) {
 		case AList:
 		{
 			int nodepos = 0;
-			for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
-				NodeInfo* nodeInfo = *it;
-
-				Json::Value node;
-				std::string nodeName = Manager::Get()->GetNodeName(g_homeId, nodeInfo->m_nodeId);
-				if(nodeName.size() == 0) {
-					nodeName = "Undefined";
-				}
-				std::string nodeType = Manager::Get()->GetNodeType(g_homeId, nodeInfo->m_nodeId);
-				std::string manufacturerName = Manager::Get()->GetNodeManufacturerName(g_homeId, nodeInfo->m_nodeId);
-				std::string productName = Manager::Get()->GetNodeProductName(g_homeId, nodeInfo->m_nodeId);
-				std::string productId = Manager::Get()->GetNodeProductId(g_homeId, nodeInfo->m_nodeId);
-
-				node["Name"] = nodeName;
-				node["ID"] = nodeInfo->m_nodeId;
-				node["Location"] = Manager::Get()->GetNodeLocation(g_homeId, nodeInfo->m_nodeId);
-				node["Type"] = nodeType;
-				node["Manufacturer"] = manufacturerName;
-				node["ProductName"] = productName;
-				node["ProductId"] = productId;
-
-				for(list<ValueID>::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
-					std::string tempstr="";
-					Manager::Get()->GetValueAsString(*vit,&tempstr);
-					node["Values"][Manager::Get()->GetValueLabel(*vit)] = tempstr;
-				}
-				stringstream ssNodeLastSeen;
-				char buffer[256];
-				struct tm * timeinfo;
-				timeinfo = localtime(&(nodeInfo->m_LastSeen));
-				if(strftime(buffer, 256, "%a %d %b %R", timeinfo) != 0)
-				{
-					ssNodeLastSeen << buffer;
-				}
-				else {
-					ssNodeLastSeen << trim(ctime(&(nodeInfo->m_LastSeen)));
-				}
-				node["LastSeen"] = ssNodeLastSeen.str();
-				message["nodes"][nodepos] = node;
+			std::shared_ptr<const StateSnapshot> snapshot = GetSnapshot();
+			for(std::vector<std::shared_ptr<const NodeInfo> >::const_iterator it = snapshot->nodes.begin(); it != snapshot->nodes.end(); ++it) {
+				message["nodes"][nodepos] = NodeToJson(it->get());
 				++nodepos;
 			}
 			break;
@@ -1329,7 +3192,7 @@ void process_commands(std::string data, Json::Value& message) {
 					}
 				}
 				if(save) {
-					Manager::Get()->WriteConfig(g_homeId);
+					SaveConfig(batch);
 				}
 			}
 
@@ -1341,17 +3204,8 @@ void process_commands(std::string data, Json::Value& message) {
 		}
 		case RoomListC:
 		{
-			Json::Value rooms(Json::arrayValue);
-			for(list<Room>::iterator rit=roomList.begin(); rit!=roomList.end(); ++rit) {
-				Json::Value room;
-				room["Name"] = rit->name;
-				room["currentSetpoint"] = rit->setpoint;
-				stringstream ssCurrentTemp;
-				ssCurrentTemp << rit->currentTemp;
-				room["currentTemp"] = ssCurrentTemp.str();
-				rooms.append(room);
-			}
-			message["rooms"] = rooms;
+			std::shared_ptr<const StateSnapshot> snapshot = GetSnapshot();
+			message["rooms"] = RoomListToJson(snapshot->rooms);
 			break;
 		}
 		case RoomC:
@@ -1360,50 +3214,37 @@ void process_commands(std::string data, Json::Value& message) {
 				throw OZWSS::ProtocolException("Wrong number of arguments", 2);
 			}
 			std::string location = trim(v[2]);
-			for(list<Room>::iterator rit=roomList.begin(); rit!=roomList.end(); ++rit) {
-				if(strcmp(location.c_str(), rit->name.c_str()) !=0) {
-					continue;
-				}
-
-				switch(s_mapStringCommands[trim(v[1])])
-				{
-					case Plus:
-						rit->setpoint += 0.5;
-						rit->changed = true;
-						break;
-					case Minus:
-						rit->setpoint -= 0.5;
-						rit->changed = true;
-						break;
-					default:
-						throw OZWSS::ProtocolException("Unknown Room command", 1);
-						break;
-				}
-				stringstream setpoint, currentTemp;
-				setpoint << rit->setpoint;
-				currentTemp << rit->currentTemp;
-				message["room"]["Name"] = location;
-				message["room"]["currentSetpoint"] = rit->setpoint;
-				stringstream ssCurrentTemp;
-				ssCurrentTemp << rit->currentTemp;
-				message["room"]["currentTemp"] = ssCurrentTemp.str();
-				std::cout << "Room " << location << " termperature setpoint set to " << rit->setpoint << endl;
+			float step = 0.0;
+			switch(CommandOf(v[1]))
+			{
+				case Plus:
+					step = 0.5;
+					break;
+				case Minus:
+					step = -0.5;
+					break;
+				default:
+					throw OZWSS::ProtocolException("Unknown Room command", 1);
+					break;
 			}
+			pthread_mutex_lock(&g_criticalSection);
+			if(Room* room = FindRoom(location)) {
+				room->setpoint += step;
+				room->changed = true;
+				message["room"] = RoomToJson(*room);
+				QueueRoomChange(location);
+				std::cout << "Room " << location << " termperature setpoint set to " << room->setpoint << endl;
+			}
+			PublishState();
+			pthread_mutex_unlock(&g_criticalSection);
 
 			SetAlarm("Thermostat", SOCKET_COLLECTION_TIMEOUT, true);
-			SetAlarm("Update", SOCKET_COLLECTION_TIMEOUT+1, true);
 			break;
 		}
 		case SceneListC:
 		{
-			int scenepos = 0;
-			for(list<SceneListItem>::iterator sliit=sceneList.begin(); sliit!=sceneList.end(); ++sliit) {
-				Json::Value scene;
-				scene["Name"] = sliit->name;
-				scene["Active"] = sliit->active;
-				message["scenes"][scenepos] = scene;
-				++scenepos;
-			}
+			std::shared_ptr<const StateSnapshot> snapshot = GetSnapshot();
+			message["scenes"] = SceneListToJson(snapshot->scenes);
 			break;
 		}
 		case SceneC:
@@ -1411,7 +3252,7 @@ void process_commands(std::string data, Json::Value& message) {
 			if(v.size() < 3) {
 				throw OZWSS::ProtocolException("Wrong number of arguments", 2);
 			}
-			switch(s_mapStringCommands[trim(v[1])])
+			switch(CommandOf(v[1]))
 			{
 				case Create:
 				{
@@ -1420,16 +3261,19 @@ void process_commands(std::string data, Json::Value& message) {
 						stringstream ssID;
 						ssID << scid;
 						Manager::Get()->SetSceneLabel(scid, sclabel);
+						pthread_mutex_lock(&g_criticalSection);
 						sceneList.clear();
 						if(init_Scenes()) {
-							SetAlarm("Update", SOCKET_COLLECTION_TIMEOUT, true);
+							QueueSceneListChange();
 							message["text"] = "Scene created with name " + sclabel +" and scene_id " + ssID.str();
 						}
 						else {
 							message["text"] = "Scene created, but scenelist could not be refreshed"; //create better error message
 						}
+						PublishState();
+						pthread_mutex_unlock(&g_criticalSection);
 					}
-					Manager::Get()->WriteConfig(g_homeId);
+					SaveConfig(batch);
 					break;
 				}
 				case Add:
@@ -1437,6 +3281,11 @@ void process_commands(std::string data, Json::Value& message) {
 					if(v.size() != 5) {
 						throw OZWSS::ProtocolException("Wrong number of arguments", 2);
 					}
+					int Node = lexical_cast<int>(v[3]);
+					std::vector<ValueID> values;
+					if(!GetMappedValues(g_homeId, Node, values)) {
+						throw OZWSS::ProtocolException("Node not found", 3);
+					}
 					uint8 numscenes = 0;
 					uint8 *sceneIds = new uint8[numscenes];
 
@@ -1446,7 +3295,6 @@ void process_commands(std::string data, Json::Value& message) {
 
 					string sclabel = trim(v[2]);
 					int scid=0;
-					int Node = lexical_cast<int>(v[3]);
 					double value = lexical_cast<double>(v[4]);
 					bool response;
 
@@ -1455,76 +3303,57 @@ void process_commands(std::string data, Json::Value& message) {
 						if(sclabel != Manager::Get()->GetSceneLabel(scid)) {
 							continue;
 						}
-						NodeInfo* nodeInfo = GetNodeInfo(g_homeId, Node);
-						uint8 cmdclass = 0;
-						if(nodeInfo->m_basicmapping > 0 || try_map_basic(g_homeId, Node)) {
-							cmdclass = nodeInfo->m_basicmapping;
-							std::cout << "mapped to " << (int) cmdclass << endl;
-						}
-						else {
-							cmdclass = COMMAND_CLASS_BASIC;
-							std::cout << "mapped to BASIC" << endl;
-						}
-						for(list<ValueID>::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
-							if((*vit).GetCommandClassId() == cmdclass) {
-								// It works fine, EXCEPT for MULTILEVEL, then we need to ignore all except the first one
-								if((*vit).GetCommandClassId() == COMMAND_CLASS_SWITCH_MULTILEVEL) {
-									if((*vit).GetIndex() != 0) {
-										continue;
-									}
+						for(std::vector<ValueID>::iterator vit = values.begin(); vit != values.end(); ++vit) {
+							switch(vit->GetType()) {
+								case ValueID::ValueType_Bool: {
+									bool bool_value;
+									bool_value = (bool)value;
+									response = Manager::Get()->AddSceneValue(scid, *vit, bool_value);
+									break;
 								}
-
-								switch((*vit).GetType()) {
-									case ValueID::ValueType_Bool: {
-										bool bool_value;
-										bool_value = (bool)value;
-										response = Manager::Get()->AddSceneValue(scid, (*vit), bool_value);
-										break;
-									}
-									case ValueID::ValueType_Byte: {
-										uint8 uint8_value;
-										uint8_value = (uint8)value;
-										response = Manager::Get()->AddSceneValue(scid, (*vit), uint8_value);
-										break;
-									}
-									case ValueID::ValueType_Short: {
-										uint16 uint16_value;
-										uint16_value = (uint16)value;
-										response = Manager::Get()->AddSceneValue(scid, (*vit), uint16_value);
-										break;
-									}
-									case ValueID::ValueType_Int: {
-										int int_value;
-										int_value = value;
-										response = Manager::Get()->AddSceneValue(scid, (*vit), int_value);
-										break;
-									}
-									case ValueID::ValueType_Decimal: {
-										float float_value;
-										float_value = (float)value;
-										response = Manager::Get()->AddSceneValue(scid, (*vit), float_value);
-										break;
-									}
-									case ValueID::ValueType_List: {
-										response = Manager::Get()->AddSceneValue(scid, (*vit), (int)value);
-										break;
-									}
-									default:
-										response = false;
-										message["error"]["err_message"] = "unknown ValueType";
-										break;
+								case ValueID::ValueType_Byte: {
+									uint8 uint8_value;
+									uint8_value = (uint8)value;
+									response = Manager::Get()->AddSceneValue(scid, *vit, uint8_value);
+									break;
 								}
-
-								if(!response) {
-									message["error"]["err_main"] = "Could not add valueid/value to scene " + sclabel + "\nPlease send me an issue at Github";
-								} else {
-									message["text"] = "Added valueid/value to scene " + sclabel;
+								case ValueID::ValueType_Short: {
+									uint16 uint16_value;
+									uint16_value = (uint16)value;
+									response = Manager::Get()->AddSceneValue(scid, *vit, uint16_value);
+									break;
 								}
+								case ValueID::ValueType_Int: {
+									int int_value;
+									int_value = value;
+									response = Manager::Get()->AddSceneValue(scid, *vit, int_value);
+									break;
+								}
+								case ValueID::ValueType_Decimal: {
+									float float_value;
+									float_value = (float)value;
+									response = Manager::Get()->AddSceneValue(scid, *vit, float_value);
+									break;
+								}
+								case ValueID::ValueType_List: {
+									response = Manager::Get()->AddSceneValue(scid, *vit, (int)value);
+									break;
+								}
+								default:
+									response = false;
+									message["error"]["err_message"] = "unknown ValueType";
+									break;
+							}
+
+							if(!response) {
+								message["error"]["err_main"] = "Could not add valueid/value to scene " + sclabel + "\nPlease send me an issue at Github";
+							} else {
+								message["text"] = "Added valueid/value to scene " + sclabel;
 							}
 						}
 					}
 					delete sceneIds;
-					Manager::Get()->WriteConfig(g_homeId);
+					SaveConfig(batch);
 					break;
 				}
 				case Remove:
@@ -1532,6 +3361,11 @@ void process_commands(std::string data, Json::Value& message) {
 					if(v.size() != 4) {
 						throw OZWSS::ProtocolException("Wrong number of arguments", 2);
 					}
+					int Node = lexical_cast<int>(v[3]);
+					std::vector<ValueID> values;
+					if(!GetMappedValues(g_homeId, Node, values)) {
+						throw OZWSS::ProtocolException("Node not found", 3);
+					}
 					uint8 numscenes = 0;
 					uint8 *sceneIds = new uint8[numscenes];
 
@@ -1541,7 +3375,6 @@ void process_commands(std::string data, Json::Value& message) {
 
 					string sclabel = trim(v[2]);
 					int scid=0;
-					int Node = lexical_cast<int>(v[3]);
 
 					for(int i=0; i<numscenes; ++i){
 						scid = sceneIds[i];
@@ -1549,31 +3382,13 @@ void process_commands(std::string data, Json::Value& message) {
 						if(sclabel != Manager::Get()->GetSceneLabel(scid)){
 							continue;
 						}
-						NodeInfo* nodeInfo = GetNodeInfo(g_homeId, Node);
-						uint8 cmdclass = 0;
-						if(nodeInfo->m_basicmapping > 0 || try_map_basic(g_homeId, Node)) {
-							cmdclass = nodeInfo->m_basicmapping;
-							std::cout << "mapped to " << (int) cmdclass << endl;
-						}
-						else {
-							cmdclass = COMMAND_CLASS_BASIC;
-							std::cout << "mapped to BASIC" << endl;
-						}
-						for(list<ValueID>::iterator vit = nodeInfo->m_values.begin(); vit != nodeInfo->m_values.end(); ++vit) {
-							if((*vit).GetCommandClassId() == cmdclass) {
-								// It works fine, EXCEPT for MULTILEVEL, then we need to ignore all except the first one
-								if((*vit).GetCommandClassId() == COMMAND_CLASS_SWITCH_MULTILEVEL) {
-									if((*vit).GetIndex() != 0) {
-										continue;
-									}
-								}
-								Manager::Get()->RemoveSceneValue(scid, (*vit));
-								message["text"] = "Removed valueid from scene" + sclabel;
-							}
+						for(std::vector<ValueID>::iterator vit = values.begin(); vit != values.end(); ++vit) {
+							Manager::Get()->RemoveSceneValue(scid, *vit);
+							message["text"] = "Removed valueid from scene" + sclabel;
 						}
 					}
 					delete sceneIds;
-					Manager::Get()->WriteConfig(g_homeId);
+					SaveConfig(batch);
 					break;
 				}
 				case Activate:
@@ -1589,7 +3404,7 @@ void process_commands(std::string data, Json::Value& message) {
 		}
 		case ControllerC:
 		{
-			switch(s_mapStringCommands[trim(v[1])])
+			switch(CommandOf(v[1]))
 			{
 				case Add: {
 					if(v.size() != 3) {
@@ -1626,6 +3441,7 @@ void process_commands(std::string data, Json::Value& message) {
 				default:
 					break;
 			}
+			break;
 		}
 		case Cron:
 		{
@@ -1641,22 +3457,27 @@ void process_commands(std::string data, Json::Value& message) {
 			}
 
 			//synchronize devices with Command_Class_Clock
+			pthread_mutex_lock(&g_criticalSection);
 			for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
+				if(!((*it)->m_roles & NODE_ROLE_CLOCK)) {
+					continue;
+				}
 				time_t rawtime;
 				tm * timeinfo;
 				time(&rawtime);
 				timeinfo=localtime(&rawtime);
 
-				for(list<ValueID>::iterator vit = (*it)->m_values.begin(); vit != (*it)->m_values.end(); ++vit) {
-					if((*vit).GetCommandClassId() != COMMAND_CLASS_CLOCK) {
+				for(OZWSS::ValueStore::iterator vit = (*it)->m_values.begin(); vit != (*it)->m_values.end(); ++vit) {
+					if(vit->m_id.GetCommandClassId() != COMMAND_CLASS_CLOCK) {
 						continue;
 					}
 
-					switch((*vit).GetIndex()) {
+					switch(vit->m_id.GetIndex()) {
 						case 0: {
 							std::string deviceDayValue;
 							const std::string DAY[]={"Sunday","Monday","Tuesday","Wednesday","Thursday","Friday","Saturday"};
-							if(Manager::Get()->GetValueListSelection((*vit), &deviceDayValue)) {
+							if(vit->m_valid) {
+								deviceDayValue = vit->m_string;
 								if(strcmp(DAY[(timeinfo->tm_wday)].c_str(), deviceDayValue.c_str()) != 0) {
 									(*it)->m_needsSync = true;
 								}
@@ -1670,7 +3491,8 @@ void process_commands(std::string data, Json::Value& message) {
 						}
 						case 1: {
 							uint8 deviceHourValue = -1;
-							if(Manager::Get()->GetValueAsByte((*vit), &deviceHourValue)) {
+							if(vit->m_valid) {
+								deviceHourValue = vit->m_byte;
 								if((int)deviceHourValue != timeinfo->tm_hour) {
 									(*it)->m_needsSync = true;
 								}
@@ -1684,7 +3506,8 @@ void process_commands(std::string data, Json::Value& message) {
 						}
 						case 2: {
 							uint8 deviceMinuteValue = -1;
-							if(Manager::Get()->GetValueAsByte((*vit), &deviceMinuteValue)) {
+							if(vit->m_valid) {
+								deviceMinuteValue = vit->m_byte;
 								if((int)deviceMinuteValue != timeinfo->tm_min) {
 									(*it)->m_needsSync = true;
 								}
@@ -1705,12 +3528,15 @@ void process_commands(std::string data, Json::Value& message) {
 				}
 				//cout << (*it)->m_needsSync << endl;
 			}
+			pthread_mutex_unlock(&g_criticalSection);
 			break;
 		}
 		case Switch:
 		{
 			message["text"] = switchAtHome();
-			SetAlarm("Update", SOCKET_COLLECTION_TIMEOUT, true);
+			pthread_mutex_lock(&g_criticalSection);
+			QueueAtHomeChange();
+			pthread_mutex_unlock(&g_criticalSection);
 			break;
 		}
 		case AtHome:
@@ -1735,11 +3561,209 @@ void process_commands(std::string data, Json::Value& message) {
 		case AlarmList:
 		{
 			int alarmpos = 0;
+			pthread_mutex_lock(&g_alarmLock);
 			for(list<Alarm>::iterator ait = alarmList.begin(); ait!=alarmList.end(); ait++) {
+				char buffer[26];
 				message["alarms"][alarmpos]["description"] = ait->description;
-				message["alarms"][alarmpos]["time"] = trim(ctime(&(ait->alarmtime)));
+				message["alarms"][alarmpos]["time"] = trim(ctime_r(&(ait->alarmtime), buffer));
 				++alarmpos;
 			}
+			pthread_mutex_unlock(&g_alarmLock);
+			break;
+		}
+		case Stats:
+		{
+			message["notifications"]["depth"] = (Json::UInt64) g_notificationQueue->Depth();
+			message["notifications"]["highwater"] = (Json::UInt64) g_notificationQueue->HighWater();
+			message["notifications"]["capacity"] = (Json::UInt64) g_notificationQueue->Capacity();
+			message["notifications"]["queued"] = (Json::UInt64) g_notificationQueue->Pushed();
+			message["notifications"]["dropped"] = (Json::UInt64) g_notificationQueue->Dropped();
+			message["notifications"]["processed"] = (Json::UInt64) g_notificationsProcessed;
+
+			pthread_mutex_lock(&g_alarmLock);
+			message["alarms"]["run"] = (Json::UInt64) g_alarmsRun;
+			message["alarms"]["pending"] = (Json::UInt64) alarmList.size();
+			message["alarms"]["latency_avg_ms"] = (Json::UInt64) (g_alarmsRun ? g_alarmLatencyTotal / g_alarmsRun : 0);
+			message["alarms"]["latency_max_ms"] = (Json::UInt64) g_alarmLatencyMax;
+			message["alarms"]["runtime_avg_ms"] = (Json::UInt64) (g_alarmsRun ? g_alarmRunTimeTotal / g_alarmsRun : 0);
+			message["alarms"]["runtime_max_ms"] = (Json::UInt64) g_alarmRunTimeMax;
+			pthread_mutex_unlock(&g_alarmLock);
+
+			pthread_mutex_lock(&g_alarmLock);
+			message["changes"]["values"]["changes"] = (Json::UInt64) g_debouncer.Changes(ValueChanges);
+			message["changes"]["values"]["messages"] = (Json::UInt64) g_debouncer.Flushes(ValueChanges);
+			message["changes"]["rooms"]["changes"] = (Json::UInt64) g_debouncer.Changes(RoomChanges);
+			message["changes"]["rooms"]["messages"] = (Json::UInt64) g_debouncer.Flushes(RoomChanges);
+			message["changes"]["scenes"]["changes"] = (Json::UInt64) g_debouncer.Changes(SceneChanges);
+			message["changes"]["scenes"]["messages"] = (Json::UInt64) g_debouncer.Flushes(SceneChanges);
+			message["changes"]["structure"]["changes"] = (Json::UInt64) g_debouncer.Changes(StructureChanges);
+			message["changes"]["structure"]["messages"] = (Json::UInt64) g_debouncer.Flushes(StructureChanges);
+			pthread_mutex_unlock(&g_alarmLock);
+
+			pthread_mutex_lock(&g_criticalSection);
+			message["state"]["version"] = (Json::UInt64) g_changeLog.Version();
+			message["state"]["epoch"] = (Json::UInt64) g_stateEpoch;
+			message["state"]["retained"] = (Json::UInt64) g_changeLog.Size();
+			message["state"]["floor"] = (Json::UInt64) g_changeLog.Floor();
+			message["state"]["sync_full"] = (Json::UInt64) g_syncFull;
+			message["state"]["sync_delta"] = (Json::UInt64) g_syncDelta;
+			pthread_mutex_unlock(&g_criticalSection);
+
+			if(g_socketServer != NULL) {
+				message["sockets"]["connections"] = (Json::UInt64) g_socketServer->Connections();
+				message["sockets"]["accepted"] = (Json::UInt64) g_socketServer->Accepted();
+				message["sockets"]["commands"] = (Json::UInt64) g_socketServer->Commands();
+				message["sockets"]["bytesin"] = (Json::UInt64) g_socketServer->BytesIn();
+				message["sockets"]["bytesout"] = (Json::UInt64) g_socketServer->BytesOut();
+			}
+
+			message["admission"]["rate"] = g_radioRate;
+			message["admission"]["burst"] = g_radioBurst;
+			message["admission"]["send_queue_limit"] = g_radioQueueLimit;
+			message["admission"]["send_queue"] = g_homeId != 0 ? Manager::Get()->GetSendQueueCount(g_homeId) : 0;
+			message["admission"]["rate_limited"] = (Json::UInt64) g_radioRateLimited;
+			message["admission"]["radio_busy"] = (Json::UInt64) g_radioBusy;
+
+			if(g_executor != NULL) {
+				for(unsigned lane = 0; lane < g_executor->Lanes(); ++lane) {
+					OZWSS::Executor::LaneStats stats = g_executor->GetLaneStats(lane);
+					Json::Value& entry = message["executor"]["lanes"][stats.name];
+					entry["workers"] = (Json::UInt64) stats.workers;
+					entry["capacity"] = (Json::UInt64) stats.capacity;
+					entry["depth"] = (Json::UInt64) stats.depth;
+					entry["highwater"] = (Json::UInt64) stats.highWater;
+					entry["rejected"] = (Json::UInt64) stats.rejected;
+				}
+				message["executor"]["commands"] = Json::Value(Json::objectValue);
+				std::map<std::string, Commands> kinds(s_mapStringCommands);
+				kinds["unknown"] = Undefined_command;
+				for(std::map<std::string, Commands>::iterator it = kinds.begin(); it != kinds.end(); ++it) {
+					OZWSS::Executor::KindStats stats = g_executor->GetKindStats(it->second);
+					if(stats.jobs == 0) {
+						continue;
+					}
+					Json::Value& entry = message["executor"]["commands"][it->first];
+					entry["count"] = (Json::UInt64) stats.jobs;
+					entry["wait_avg_us"] = (Json::UInt64) (stats.waitTotal / stats.jobs);
+					entry["wait_max_us"] = (Json::UInt64) stats.waitMax;
+					entry["run_avg_us"] = (Json::UInt64) (stats.runTotal / stats.jobs);
+					entry["run_max_us"] = (Json::UInt64) stats.runMax;
+				}
+			}
+
+			message["deflate"]["enabled"] = g_deflate;
+			message["deflate"]["messages"] = (Json::UInt64) g_deflateMessages;
+			message["deflate"]["skipped"] = (Json::UInt64) g_deflateSkipped;
+			message["deflate"]["bytesin"] = (Json::UInt64) g_deflateBytesIn;
+			message["deflate"]["bytesout"] = (Json::UInt64) g_deflateBytesOut;
+
+			message["sessions"] = Json::Value(Json::arrayValue);
+			pthread_mutex_lock(&g_sessionLock);
+			for(list<Session*>::iterator it = g_sessions.begin(); it != g_sessions.end(); ++it) {
+				Json::Value session;
+				session["id"] = (Json::UInt64) (*it)->id;
+				session["authenticated"] = (*it)->authenticated;
+				session["encoding"] = OZWSS::EncodingName((*it)->encoding);
+				session["depth"] = (Json::UInt64) (*it)->queue.Depth();
+				session["bytes"] = (Json::UInt64) (*it)->queue.Bytes();
+				session["highwater"] = (Json::UInt64) (*it)->queue.HighWater();
+				session["queued"] = (Json::UInt64) (*it)->queue.Queued();
+				session["sent"] = (Json::UInt64) (*it)->queue.SentMessages();
+				session["sentbytes"] = (Json::UInt64) (*it)->queue.SentBytes();
+				session["dropped"] = (Json::UInt64) (*it)->queue.Dropped();
+				session["coalesced"] = (Json::UInt64) (*it)->queue.Coalesced();
+				session["topics"] = (Json::UInt64) (*it)->topics.size();
+				session["throttled"] = (Json::UInt64) (*it)->throttled;
+				message["sessions"].append(session);
+			}
+			pthread_mutex_unlock(&g_sessionLock);
+			break;
+		}
+		case Subscribe:
+		case Unsubscribe:
+		{
+			throw OZWSS::ProtocolException("Subscriptions are only available on websocket connections", 5);
+			break;
+		}
+		case EncodingC:
+		{
+			throw OZWSS::ProtocolException("The encoding of a websocket connection is chosen by its subprotocol", 5);
+			break;
+		}
+		case Sync:
+		{
+			if(v.size() < 2 || v.size() > 3) {
+				throw OZWSS::ProtocolException("Wrong number of arguments", 2);
+			}
+			uint64 since = lexical_cast<uint64>(trim(v[1]));
+			bool sameEpoch = (v.size() < 3 || lexical_cast<uint64>(trim(v[2])) == (uint64) g_stateEpoch);
+
+			pthread_mutex_lock(&g_criticalSection);
+			std::vector<StateEntity> entities;
+			// version 0 is a client that has nothing yet
+			bool full = (since == 0 || !sameEpoch || !g_changeLog.Since(since, entities));
+			message["version"] = (Json::UInt64) g_changeLog.Version();
+			message["epoch"] = (Json::UInt64) g_stateEpoch;
+			message["full"] = full;
+			message["nodes"] = Json::Value(Json::arrayValue);
+			message["values"] = Json::Value(Json::arrayValue);
+			message["rooms"] = Json::Value(Json::arrayValue);
+			if(full) {
+				++g_syncFull;
+				for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
+					message["nodes"].append(NodeToJson(*it));
+				}
+				message["rooms"] = RoomListToJson(std::vector<Room>(roomList.begin(), roomList.end()));
+				message["scenes"] = SceneListToJson(std::vector<SceneListItem>(sceneList.begin(), sceneList.end()));
+				message["athome"] = atHome;
+			}
+			else {
+				++g_syncDelta;
+				message["removed"]["nodes"] = Json::Value(Json::arrayValue);
+				message["removed"]["rooms"] = Json::Value(Json::arrayValue);
+				for(std::vector<StateEntity>::iterator it = entities.begin(); it != entities.end(); ++it) {
+					switch(it->kind) {
+						case NodeEntity:
+							if(NodeInfo* nodeInfo = GetNodeInfo(it->homeId, (uint8) it->id)) {
+								message["nodes"].append(NodeToJson(nodeInfo));
+							}
+							else {
+								message["removed"]["nodes"].append((Json::UInt) it->id);
+							}
+							break;
+						case ValueEntity: {
+							// values of removed nodes go with the node
+							ValueID valueId(it->homeId, it->id);
+							NodeInfo* nodeInfo = GetNodeInfo(valueId.GetHomeId(), valueId.GetNodeId());
+							OZWSS::ValueInfo* valueInfo = nodeInfo ? nodeInfo->m_values.Find(valueId) : NULL;
+							if(valueInfo != NULL) {
+								message["values"].append(ValueToJson(nodeInfo, valueInfo));
+							}
+							break;
+						}
+						case RoomEntity:
+							if(Room* room = FindRoom(it->name)) {
+								message["rooms"].append(RoomToJson(*room));
+							}
+							else {
+								message["removed"]["rooms"].append(it->name);
+							}
+							break;
+						case ScenesEntity:
+							message["scenes"] = SceneListToJson(std::vector<SceneListItem>(sceneList.begin(), sceneList.end()));
+							break;
+						case AtHomeEntity:
+							message["athome"] = atHome;
+							break;
+					}
+				}
+			}
+			pthread_mutex_unlock(&g_criticalSection);
+			break;
+		}
+		case Batch:
+		{
+			RunBatch(data, message);
 			break;
 		}
 		case Test:
@@ -1767,6 +3791,13 @@ bool parse_option(int32 home, int32 node, std::string name, std::string value, b
 		{
 			pthread_mutex_lock(&g_criticalSection);
 			Manager::Get()->SetNodeName(home, node, value);
+			if(NodeInfo* nodeInfo = GetNodeInfo(home, node)) {
+				nodeInfo->m_name = value;
+				MarkNodeChanged(home, node);
+				g_changeLog.Stamp(StateEntity::Node(home, node));
+				QueueStructureChange();
+				PublishState();
+			}
 			pthread_mutex_unlock(&g_criticalSection);
 			save = true;
 			return true;
@@ -1776,10 +3807,19 @@ bool parse_option(int32 home, int32 node, std::string name, std::string value, b
 		{
 			pthread_mutex_lock(&g_criticalSection);
 			Manager::Get()->SetNodeLocation(home, node, value);
-			pthread_mutex_unlock(&g_criticalSection);
+			bool roomsBuilt = true;
+			if(NodeInfo* nodeInfo = GetNodeInfo(home, node)) {
+				std::string previousLocation = nodeInfo->m_location;
+				nodeInfo->m_location = value;
+				roomsBuilt = MoveRoomMember(nodeInfo, previousLocation);
+				MarkNodeChanged(home, node);
+				g_changeLog.Stamp(StateEntity::Node(home, node));
+				QueueStructureChange();
+			}
 			save = true;
-			roomList.clear();
-			return init_Rooms(); //can do this more efficiently, patch welcome
+			PublishState();
+			pthread_mutex_unlock(&g_criticalSection);
+			return roomsBuilt;
 			break;
 		}
 		case SwitchC:
@@ -1806,49 +3846,32 @@ bool parse_option(int32 home, int32 node, std::string name, std::string value, b
 				err_message += "Node is a controller\n";
 				return false;
 			}
-			if(NodeInfo* nodeInfo = GetNodeInfo(home, node)) {
-				uint8 cmdclass = 0;
-				if(nodeInfo->m_basicmapping > 0 || try_map_basic(home, node)) {
-					cmdclass = nodeInfo->m_basicmapping;
-					std::cout << "mapped to " << (int) cmdclass << endl;
-				}
-				else {
-					cmdclass = COMMAND_CLASS_BASIC;
-					std::cout << "mapped to BASIC" << endl;
-				}
-
+			std::vector<ValueID> values;
+			if(GetMappedValues(home, node, values)) {
 				// Mark the basic command class values for polling
-				for(list<ValueID>::iterator it = nodeInfo->m_values.begin(); it != nodeInfo->m_values.end(); ++it){
-					if((*it).GetCommandClassId() == cmdclass) {
-						// It works fine, EXCEPT for MULTILEVEL, then we need to ignore all except the first one
-						if((*it).GetCommandClassId() == COMMAND_CLASS_SWITCH_MULTILEVEL) {
-							if((*it).GetIndex() != 0) {
-								continue;
-							}
-						}
-						if(lexical_cast<int>(value) == 1) {
-							if(!Manager::Get()->EnablePoll(*it)) {
-								err_message += "Could not enable polling for this value\n";
-								return false;
-							}
-						}
-						else if(lexical_cast<int>(value) >= 2) {
-							if(!Manager::Get()->EnablePoll(*it, 2)) {
-								err_message += "Could not enable polling for this value\n";
-								return false;
-							}
+				for(std::vector<ValueID>::iterator vit = values.begin(); vit != values.end(); ++vit) {
+					if(lexical_cast<int>(value) == 1) {
+						if(!Manager::Get()->EnablePoll(*vit)) {
+							err_message += "Could not enable polling for this value\n";
+							return false;
 						}
-						else {
-							if(!Manager::Get()->DisablePoll(*it)) {
-								err_message += "Could not disable polling for this value\n";
-								return false;
-							}
+					}
+					else if(lexical_cast<int>(value) >= 2) {
+						if(!Manager::Get()->EnablePoll(*vit, 2)) {
+							err_message += "Could not enable polling for this value\n";
+							return false;
 						}
-						if(!found)
-						{
-							found = true;
+					}
+					else {
+						if(!Manager::Get()->DisablePoll(*vit)) {
+							err_message += "Could not disable polling for this value\n";
+							return false;
 						}
 					}
+					if(!found)
+					{
+						found = true;
+					}
 				}
 				if(!found) {
 					err_message += "Node does not have COMMAND_CLASS_BASIC\n";
@@ -1910,46 +3933,50 @@ bool SetValue(int32 home, int32 node, std::string const value, uint8 cmdclass, s
 	bool response;
 	bool cmdfound = false;
 
-	if(NodeInfo* nodeInfo = GetNodeInfo(home, node)) {
-		// Find the correct instance
-		for(list<ValueID>::iterator it = nodeInfo->m_values.begin(); it != nodeInfo->m_values.end(); ++it) {
-			int id = (*it).GetCommandClassId();
-			if(id != cmdclass) {
-				continue;
-			}
-
-			if(label != Manager::Get()->GetValueLabel(*it)) {
-				continue;
-			}
+	// Find the correct instance, the store may change once we let go of it
+	pthread_mutex_lock(&g_criticalSection);
+	std::vector<ValueID> values;
+	NodeInfo* nodeInfo = GetNodeInfo(home, node);
+	bool const nodeFound = nodeInfo != NULL;
+	if(nodeFound) {
+		std::vector<OZWSS::ValueInfo*> found = nodeInfo->m_values.FindAll(cmdclass, label);
+		for(std::vector<OZWSS::ValueInfo*>::iterator vit = found.begin(); vit != found.end(); ++vit) {
+			values.push_back((*vit)->m_id);
+		}
+	}
+	pthread_mutex_unlock(&g_criticalSection);
 
-			switch((*it).GetType()) {
+	if(nodeFound) {
+		for(std::vector<ValueID>::iterator vit = values.begin(); vit != values.end(); ++vit) {
+			ValueID const& vid = *vit;
+			switch(vid.GetType()) {
 				case ValueID::ValueType_Bool: {
-					response = Manager::Get()->SetValue(*it, lexical_cast<bool>(value));
+					response = Manager::Get()->SetValue(vid, lexical_cast<bool>(value));
 					cmdfound = true;
 					break;
 				}
 				case ValueID::ValueType_Byte: {
-					response = Manager::Get()->SetValue(*it, (uint8) lexical_cast<int>(value));
+					response = Manager::Get()->SetValue(vid, (uint8) lexical_cast<int>(value));
 					cmdfound = true;
 					break;
 				}
 				case ValueID::ValueType_Short: {
-					response = Manager::Get()->SetValue(*it, (uint16) lexical_cast<int>(value));
+					response = Manager::Get()->SetValue(vid, (uint16) lexical_cast<int>(value));
 					cmdfound = true;
 					break;
 				}
 				case ValueID::ValueType_Int: {
-					response = Manager::Get()->SetValue(*it, lexical_cast<int>(value));
+					response = Manager::Get()->SetValue(vid, lexical_cast<int>(value));
 					cmdfound = true;
 					break;
 				}
 				case ValueID::ValueType_Decimal: {
-					response = Manager::Get()->SetValue(*it, lexical_cast<float>(value));
+					response = Manager::Get()->SetValue(vid, lexical_cast<float>(value));
 					cmdfound = true;
 					break;
 				}
 				case ValueID::ValueType_List: {
-					response = Manager::Get()->SetValueListSelection(*it, value);
+					response = Manager::Get()->SetValueListSelection(vid, value);
 					cmdfound = true;
 					break;
 				}
@@ -2070,36 +4097,6 @@ std::string switchAtHome() {
 	return output;
 }
 
-//-----------------------------------------------------------------------------
-// try_map_basic
-// Try to map the basic command class for a node to the proper command class
-//-----------------------------------------------------------------------------
-bool try_map_basic(int32 home, int32 node) {
-	char buffer[10];
-	if(NodeInfo* nodeInfo = GetNodeInfo(home, node)) {
-		uint8 generic = Manager::Get()->GetNodeGeneric(home, node);
-		uint8 specific = Manager::Get()->GetNodeSpecific(home, node);
-
-		snprintf(buffer, 10, "0x%02X|0x%02X", generic, specific);
-		if(MapCommandClassBasic.find(buffer) != MapCommandClassBasic.end()) {
-			nodeInfo->m_basicmapping = MapCommandClassBasic[buffer];
-			return true;
-		}
-		else {
-			// We didn't find a Generic+Specifc in the table, now we check
-			// for Generic only
-			snprintf(buffer, 10, "0x%02X", generic);
-
-			// Check if we have a mapping in our map table
-			if(MapCommandClassBasic.find(buffer) != MapCommandClassBasic.end()) {
-				nodeInfo->m_basicmapping = MapCommandClassBasic[buffer];
-				return true;
-			}
-		}
-	}
-	return false;
-}
-
 void SetAlarm(std::string description, time_t alarmtime, bool offset) {
 	time_t now = time(NULL);
 	Alarm newAlarm;
@@ -2109,27 +4106,94 @@ void SetAlarm(std::string description, time_t alarmtime, bool offset) {
 	} else {
 		newAlarm.alarmtime = alarmtime;
 	}
+	// a time of day that has passed already (CRON after sunrise) is not run,
+	// only alarms that became due while the timer was busy are run late
+	if(!offset && newAlarm.alarmtime <= now) {
+		std::cout << "Not setting alarm " << description << ", its time has passed" << endl;
+		return;
+	}
 
-	while(!alarmList.empty() && (alarmList.front().alarmtime) <= now)
-		{alarmList.pop_front();}
-
+	pthread_mutex_lock(&g_alarmLock);
 	alarmList.push_back(newAlarm);
 	alarmList.sort();
 	alarmList.unique();
+	pthread_cond_signal(&g_alarmCond);
+	pthread_mutex_unlock(&g_alarmLock);
+}
+
+//-----------------------------------------------------------------------------
+// <timer_main>
+// Wait for the next alarm on the alarmList or for collected changes to be
+// due, and run it on this thread
+// SetAlarm and NoteChange wake us up when something is added
+//-----------------------------------------------------------------------------
+void *timer_main(void* arg) {
+	pthread_mutex_lock(&g_alarmLock);
+	while(!stopping) {
+		uint64 nowMs = NowMs();
+		if(uint32 due = g_debouncer.Due(nowMs)) {
+			pthread_mutex_unlock(&g_alarmLock);
+			ChangeSet changes;
+			TakeChanges(changes, due);
+			// until the websocket server runs there is nobody to send to,
+			// clients load the whole state when they connect
+			if(context.load() != NULL && (changes.HasChanges() || changes.structure)) {
+				BroadcastChanges(changes);
+			}
+			pthread_mutex_lock(&g_alarmLock);
+			continue;
+		}
+
+		time_t now = time(NULL);
+		if(alarmList.empty() || alarmList.front().alarmtime > now) {
+			// wake up at least every second to see if we are stopping
+			uint64 deadlineMs = (uint64) (now + 1) * 1000;
+			if(!alarmList.empty() && (uint64) alarmList.front().alarmtime * 1000 < deadlineMs) {
+				deadlineMs = (uint64) alarmList.front().alarmtime * 1000;
+			}
+			uint64 changesDue = g_debouncer.Deadline();
+			if(changesDue != 0 && changesDue < deadlineMs) {
+				deadlineMs = changesDue;
+			}
+			struct timespec deadline;
+			deadline.tv_sec = deadlineMs / 1000;
+			deadline.tv_nsec = (deadlineMs % 1000) * 1000000;
+			pthread_cond_timedwait(&g_alarmCond, &g_alarmLock, &deadline);
+			continue;
+		}
 
-	signal(SIGALRM, sigalrm_handler);
-	alarm(alarmList.front().alarmtime - now);
+		Alarm currentAlarm = alarmList.front();
+		alarmList.pop_front();
+		pthread_mutex_unlock(&g_alarmLock);
+
+		struct timespec started, finished;
+		clock_gettime(CLOCK_REALTIME, &started);
+		run_alarm(currentAlarm);
+		clock_gettime(CLOCK_REALTIME, &finished);
+
+		uint64 latency = 0;
+		if(started.tv_sec >= currentAlarm.alarmtime) {
+			latency = (uint64) (started.tv_sec - currentAlarm.alarmtime) * 1000 + started.tv_nsec / 1000000;
+		}
+		uint64 runTime = (uint64) (finished.tv_sec - started.tv_sec) * 1000 + (finished.tv_nsec - started.tv_nsec) / 1000000;
+
+		pthread_mutex_lock(&g_alarmLock);
+		++g_alarmsRun;
+		g_alarmLatencyTotal += latency;
+		g_alarmLatencyMax = std::max(g_alarmLatencyMax, latency);
+		g_alarmRunTimeTotal += runTime;
+		g_alarmRunTimeMax = std::max(g_alarmRunTimeMax, runTime);
+	}
+	pthread_mutex_unlock(&g_alarmLock);
+	return NULL;
 }
 
 //-----------------------------------------------------------------------------
-// sigalrm_handler
-// Gets invoked when a Alarm goes off
+// run_alarm
+// Gets invoked by the timer thread when a Alarm goes off
 // take apropriate action for the type of Alarm
 //-----------------------------------------------------------------------------
-void sigalrm_handler(int sig) {
-	alarmset = false;
-	Alarm currentAlarm = alarmList.front();
-	alarmList.pop_front();
+void run_alarm(Alarm const& currentAlarm) {
 
 	switch(s_mapStringTriggers[currentAlarm.description])
 	{
@@ -2169,57 +4233,31 @@ void sigalrm_handler(int sig) {
 		}
 		case Thermostat:
 		{
+			pthread_mutex_lock(&g_criticalSection);
 			for(list<Room>::iterator rit = roomList.begin(); rit != roomList.end(); ++rit) {
 				std::cout << "sending commands for room " << rit->name << endl;
 				if(rit->changed) {
-					for(list<NodeInfo*>::iterator it = g_nodes.begin(); it != g_nodes.end(); ++it) {
-						if(strcmp(rit->name.c_str(), Manager::Get()->GetNodeLocation(g_homeId, (*it)->m_nodeId).c_str()) != 0) {
-							continue;
-						}
-						if(strcmp(Manager::Get()->GetNodeType(g_homeId, (*it)->m_nodeId).c_str(), "Setpoint Thermostat") !=0) {
-							continue;
-						}
-						stringstream ssCurrentSetpoint;
-						ssCurrentSetpoint << rit->setpoint;
+					stringstream ssCurrentSetpoint;
+					ssCurrentSetpoint << rit->setpoint;
+					for(std::vector<uint8>::iterator nit = rit->thermostats.begin(); nit != rit->thermostats.end(); ++nit) {
 						uint8 cmdclass = COMMAND_CLASS_THERMOSTAT_SETPOINT;
 						string err_message = "";
-						if(!SetValue(g_homeId, (*it)->m_nodeId, ssCurrentSetpoint.str(), cmdclass, "Heating 1", err_message)) {
+						if(!SetValue(g_homeId, *nit, ssCurrentSetpoint.str(), cmdclass, "Heating 1", err_message)) {
 							std::cout << err_message;
 						}
 					}
+					rit->changed = false;
 				}
 			}
-			break;
-		}
-		case Update:
-		{
-			std::cout << "Adding notification to message list" << endl;
-
-			Json::Value message;
-			message["command"] = "UPDATE";
-			//add individual updates for devices or scenes later
-
-			LWSMessage lwsmessage;
-			Json::FastWriter fastWriter;
-			lwsmessage.message = fastWriter.write(message);
-			lwsmessage.broadcast = true;
-
-			ringbuffer[ringbuffer_head] = lwsmessage;
-
-			if (ringbuffer_head == (MAX_MESSAGE_QUEUE - 1)) {
-				ringbuffer_head = 0;
-			}
-			else {
-				ringbuffer_head++;
-			}
-
-			lws_callback_on_writable_all_protocol(context, protocols+1);
+			pthread_mutex_unlock(&g_criticalSection);
 			break;
 		}
 		case Cache_init:
 		{
+			pthread_mutex_lock(&g_criticalSection);
 			WakeupIntervalCache.clear();
 			init_WakeupIntervalCache();
+			pthread_mutex_unlock(&g_criticalSection);
 			break;
 		}
 		default:
@@ -2228,15 +4266,4 @@ void sigalrm_handler(int sig) {
 			// if that fails, check if the description can be parsed as a command
 		break;
 	}
-
-	// more alarms on the alarmList? Set the next one (the list is already sorted...)
-	time_t now = time(NULL);
-	// remove alarms that are set in the past...
-	while(!alarmList.empty() && (alarmList.front().alarmtime) <= now)
-	{alarmList.pop_front();}
-	// set the next alarm
-	if(!alarmList.empty() && !alarmset && (alarmList.front().alarmtime > now)) {
-		alarm((alarmList.front().alarmtime - now));
-		alarmset = true;
-	}
 }
@@ -4,6 +4,7 @@
 #include <stdexcept>
 #include <string>
 #include <sstream>
+#include <stdint.h>
 
 namespace OZWSS {
 	class ProtocolException : public std::runtime_error {
@@ -21,9 +22,30 @@ namespace OZWSS {
 				return what;
 			}
 
+			int Code() const { return m_code; }
+
 		private:
 			int m_code;
 	};
+
+	// A command that was not run because the server or the Z-Wave network
+	// is too busy, the client may send it again after RetryAfter milliseconds
+	class BusyException : public ProtocolException {
+		public:
+			BusyException (std::string s, uint64_t retryAfter) : ProtocolException(s + ", retry after " + ToString(retryAfter) + " ms", 6), m_retryAfter(retryAfter) {};
+			virtual ~BusyException() throw () {}
+
+			uint64_t RetryAfter() const { return m_retryAfter; }
+
+		private:
+			static std::string ToString(uint64_t value) {
+				std::stringstream ss;
+				ss << value;
+				return ss.str();
+			}
+
+			uint64_t m_retryAfter;
+	};
 } // namespace
 
 #endif // OZWSS_PROTOCOLEXCEPTION_H_
@@ -0,0 +1,153 @@
+#ifndef OZWSS_SENDQUEUE_H_
+#define OZWSS_SENDQUEUE_H_
+
+#include <deque>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Frame.h"
+
+namespace OZWSS {
+	// What to do when a client does not read its messages fast enough
+	enum SlowConsumerPolicy {
+		DropOldest = 0,	// drop the oldest change messages to make room
+		Coalesce,		// replace all queued change messages by a single resync message
+		Disconnect		// give up on the client
+	};
+
+	// Outgoing messages of one client, bounded in number of messages and bytes.
+	// Change messages may be dropped or coalesced when the client falls behind,
+	// responses to its own commands are only dropped as a last resort.
+	// Not thread safe, callers hold a lock.
+	class SendQueue {
+		public:
+			struct Entry {
+				FramePtr		frame;
+				bool			change;
+				bool			sending;
+			};
+
+			SendQueue(size_t maxMessages_, size_t maxBytes_, SlowConsumerPolicy policy_, FramePtr const& resync_) :
+				m_maxMessages(maxMessages_), m_maxBytes(maxBytes_), m_policy(policy_), m_resync(resync_), m_bytes(0),
+				m_highWater(0), m_queued(0), m_sent(0), m_sentBytes(0), m_dropped(0), m_coalesced(0) {}
+
+			// Queue a message. Returns false when the client has to be disconnected.
+			bool Push(FramePtr const& frame, bool change) {
+				Entry entry;
+				entry.frame = frame;
+				entry.change = change;
+				entry.sending = false;
+				m_entries.push_back(entry);
+				m_bytes += frame->Length();
+				++m_queued;
+
+				if(Full()) {
+					switch(m_policy) {
+						case Disconnect:
+							return false;
+						case Coalesce:
+							CoalesceChanges();
+							break;
+						case DropOldest:
+						default:
+							DropChanges();
+							break;
+					}
+					while(Full() && m_entries.size() > 1 && !m_entries.front().sending) {
+						PopFront();
+						++m_dropped;
+					}
+				}
+				if(m_entries.size() > m_highWater) {
+					m_highWater = m_entries.size();
+				}
+				return true;
+			}
+
+			// The message to write next. It stays queued, but is no longer
+			// dropped or coalesced, until Sent is called.
+			FramePtr Next() {
+				if(m_entries.empty()) {
+					return FramePtr();
+				}
+				m_entries.front().sending = true;
+				return m_entries.front().frame;
+			}
+
+			// The message returned by Next has been written to the client
+			void Sent() {
+				m_sentBytes += m_entries.front().frame->Length();
+				++m_sent;
+				PopFront();
+			}
+
+			bool Empty() const { return m_entries.empty(); }
+			size_t Depth() const { return m_entries.size(); }
+			size_t Bytes() const { return m_bytes; }
+			size_t HighWater() const { return m_highWater; }
+			uint64_t Queued() const { return m_queued; }
+			uint64_t SentMessages() const { return m_sent; }
+			uint64_t SentBytes() const { return m_sentBytes; }
+			uint64_t Dropped() const { return m_dropped; }
+			uint64_t Coalesced() const { return m_coalesced; }
+
+		private:
+			bool Full() const {
+				return m_entries.size() > m_maxMessages || m_bytes > m_maxBytes;
+			}
+
+			void PopFront() {
+				m_bytes -= m_entries.front().frame->Length();
+				m_entries.pop_front();
+			}
+
+			void DropChanges() {
+				std::deque<Entry>::iterator it = m_entries.begin();
+				while(Full() && it != m_entries.end()) {
+					if(it->change && !it->sending) {
+						m_bytes -= it->frame->Length();
+						it = m_entries.erase(it);
+						++m_dropped;
+					}
+					else {
+						++it;
+					}
+				}
+			}
+
+			void CoalesceChanges() {
+				std::deque<Entry>::iterator it = m_entries.begin();
+				while(it != m_entries.end()) {
+					if(it->change && !it->sending) {
+						m_bytes -= it->frame->Length();
+						it = m_entries.erase(it);
+						++m_coalesced;
+					}
+					else {
+						++it;
+					}
+				}
+				Entry entry;
+				entry.frame = m_resync;
+				entry.change = true;
+				entry.sending = false;
+				m_entries.push_back(entry);
+				m_bytes += m_resync->Length();
+			}
+
+			size_t				m_maxMessages;
+			size_t				m_maxBytes;
+			SlowConsumerPolicy	m_policy;
+			FramePtr			m_resync;
+			std::deque<Entry>	m_entries;
+			size_t				m_bytes;
+			size_t				m_highWater;
+			uint64_t			m_queued;
+			uint64_t			m_sent;
+			uint64_t			m_sentBytes;
+			uint64_t			m_dropped;
+			uint64_t			m_coalesced;
+	};
+}
+
+#endif /* OZWSS_SENDQUEUE_H_ */
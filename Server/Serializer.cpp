@@ -0,0 +1,144 @@
+#include "Serializer.h"
+
+#include <strings.h>
+#include <stdint.h>
+#include <cstring>
+
+namespace OZWSS {
+	namespace {
+		// CBOR major types
+		enum {
+			MajorUnsigned = 0,
+			MajorNegative = 1,
+			MajorText = 3,
+			MajorArray = 4,
+			MajorMap = 5,
+			MajorSimple = 7
+		};
+
+		// The initial byte of a data item and its argument in the shortest form
+		void WriteHead(std::string& out, uint8_t major, uint64_t argument) {
+			major <<= 5;
+			if(argument < 24) {
+				out += (char)(major | argument);
+			}
+			else if(argument <= 0xff) {
+				out += (char)(major | 24);
+				out += (char)argument;
+			}
+			else if(argument <= 0xffff) {
+				out += (char)(major | 25);
+				out += (char)(argument >> 8);
+				out += (char)argument;
+			}
+			else if(argument <= 0xffffffffULL) {
+				out += (char)(major | 26);
+				for(int shift = 24; shift >= 0; shift -= 8) {
+					out += (char)(argument >> shift);
+				}
+			}
+			else {
+				out += (char)(major | 27);
+				for(int shift = 56; shift >= 0; shift -= 8) {
+					out += (char)(argument >> shift);
+				}
+			}
+		}
+
+		void WriteText(std::string& out, std::string const& text) {
+			WriteHead(out, MajorText, text.length());
+			out += text;
+		}
+
+		// Reals go out as single precision when that loses nothing
+		void WriteReal(std::string& out, double real) {
+			float single = (float)real;
+			if((double)single == real || real != real) {
+				uint32_t bits;
+				memcpy(&bits, &single, sizeof(bits));
+				out += (char)((MajorSimple << 5) | 26);
+				for(int shift = 24; shift >= 0; shift -= 8) {
+					out += (char)(bits >> shift);
+				}
+			}
+			else {
+				uint64_t bits;
+				memcpy(&bits, &real, sizeof(bits));
+				out += (char)((MajorSimple << 5) | 27);
+				for(int shift = 56; shift >= 0; shift -= 8) {
+					out += (char)(bits >> shift);
+				}
+			}
+		}
+
+		void WriteCbor(std::string& out, Json::Value const& value) {
+			switch(value.type()) {
+				case Json::nullValue:
+					out += (char)0xf6;
+					break;
+				case Json::booleanValue:
+					out += (char)(value.asBool() ? 0xf5 : 0xf4);
+					break;
+				case Json::intValue: {
+					Json::Int64 number = value.asInt64();
+					if(number < 0) {
+						WriteHead(out, MajorNegative, (uint64_t)(-1 - number));
+					}
+					else {
+						WriteHead(out, MajorUnsigned, (uint64_t)number);
+					}
+					break;
+				}
+				case Json::uintValue:
+					WriteHead(out, MajorUnsigned, value.asUInt64());
+					break;
+				case Json::realValue:
+					WriteReal(out, value.asDouble());
+					break;
+				case Json::stringValue:
+					WriteText(out, value.asString());
+					break;
+				case Json::arrayValue:
+					WriteHead(out, MajorArray, value.size());
+					for(Json::ArrayIndex i = 0; i < value.size(); ++i) {
+						WriteCbor(out, value[i]);
+					}
+					break;
+				case Json::objectValue: {
+					WriteHead(out, MajorMap, value.size());
+					for(Json::Value::const_iterator it = value.begin(); it != value.end(); ++it) {
+						WriteText(out, it.name());
+						WriteCbor(out, *it);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	bool ParseEncoding(std::string const& name_, Encoding& encoding_) {
+		if(strcasecmp(name_.c_str(), "JSON") == 0) {
+			encoding_ = JsonEncoding;
+			return true;
+		}
+		if(strcasecmp(name_.c_str(), "CBOR") == 0) {
+			encoding_ = CborEncoding;
+			return true;
+		}
+		return false;
+	}
+
+	char const* EncodingName(Encoding encoding_) {
+		return encoding_ == CborEncoding ? "CBOR" : "JSON";
+	}
+
+	std::string Serialize(Json::Value const& value_, Encoding encoding_) {
+		if(encoding_ == CborEncoding) {
+			std::string out;
+			WriteCbor(out, value_);
+			return out;
+		}
+		Json::FastWriter fastWriter;
+		return fastWriter.write(value_);
+	}
+}
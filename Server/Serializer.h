@@ -0,0 +1,25 @@
+#ifndef OZWSS_SERIALIZER_H_
+#define OZWSS_SERIALIZER_H_
+
+#include <string>
+
+#include <json/json.h>
+
+namespace OZWSS {
+	// How messages to a client are encoded. Every message is built as a
+	// Json::Value and serialized once per encoding in use.
+	enum Encoding {
+		JsonEncoding = 0,	// JSON text, as written by Json::FastWriter
+		CborEncoding,		// CBOR (RFC 7049), the same structure in binary form
+		NumEncodings
+	};
+
+	// The encoding named by name_ ("JSON" or "CBOR", any case). Returns false
+	// for an unknown name.
+	bool ParseEncoding(std::string const& name_, Encoding& encoding_);
+	char const* EncodingName(Encoding encoding_);
+
+	std::string Serialize(Json::Value const& value_, Encoding encoding_);
+}
+
+#endif /* OZWSS_SERIALIZER_H_ */
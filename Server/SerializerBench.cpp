@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+// SerializerBench.cpp
+//
+// Size and encode time of representative server messages in each encoding.
+// Builds an ALIST reply and a CHANGES broadcast shaped like the ones Main.cpp
+// sends and prints bytes and ns/op for OZWSS::Serialize with JSON and CBOR.
+//
+// usage: serializer-bench [iterations]
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <time.h>
+
+#include <json/json.h>
+
+#include "Serializer.h"
+
+namespace {
+	// Mirrors the value labels of a typical multi sensor or thermostat node
+	char const* const s_labels[] = {
+		"Switch", "Level", "Temperature", "Luminance", "Relative Humidity",
+		"Battery Level", "Power", "Energy"
+	};
+	size_t const s_numLabels = sizeof(s_labels) / sizeof(s_labels[0]);
+
+	//-----------------------------------------------------------------------------
+	// <MakeNode>
+	// a node as NodeToJson writes it in ALIST
+	//-----------------------------------------------------------------------------
+	Json::Value MakeNode(int nodeId) {
+		std::stringstream ssName;
+		ssName << "Node " << nodeId;
+		Json::Value node;
+		node["Name"] = ssName.str();
+		node["ID"] = nodeId;
+		node["Location"] = "Living room";
+		node["Type"] = "Multilevel Sensor";
+		node["Manufacturer"] = "Aeotec";
+		node["ProductName"] = "ZW100 MultiSensor 6";
+		node["ProductId"] = "0x0064";
+		for(size_t i = 0; i < s_numLabels; ++i) {
+			std::stringstream ssValue;
+			ssValue << (nodeId * 7 + i * 13) % 100 << "." << i;
+			node["Values"][s_labels[i]] = ssValue.str();
+		}
+		node["LastSeen"] = "Sat 17 Oct 21:04";
+		return node;
+	}
+
+	//-----------------------------------------------------------------------------
+	// <MakeAList>
+	// the ALIST reply for a network of nodes_ nodes
+	//-----------------------------------------------------------------------------
+	Json::Value MakeAList(int nodes_) {
+		Json::Value message;
+		message["command"] = "ALIST";
+		for(int i = 0; i < nodes_; ++i) {
+			message["nodes"][i] = MakeNode(i + 1);
+		}
+		return message;
+	}
+
+	//-----------------------------------------------------------------------------
+	// <MakeChanges>
+	// a CHANGES broadcast as ChangesToJson writes it, with values_ value
+	// changes (as ValueToJson) and rooms_ room changes (as RoomToJson)
+	//-----------------------------------------------------------------------------
+	Json::Value MakeChanges(int values_, int rooms_) {
+		Json::Value message;
+		message["command"] = "CHANGES";
+		message["values"] = Json::Value(Json::arrayValue);
+		message["rooms"] = Json::Value(Json::arrayValue);
+		for(int i = 0; i < values_; ++i) {
+			std::stringstream ssValueId;
+			ssValueId << 72057594160332801ULL + i * 65536ULL;
+			std::stringstream ssValue;
+			ssValue << 20 + i % 5 << ".5";
+			Json::Value value;
+			value["node"] = i % 20 + 1;
+			value["valueid"] = ssValueId.str();
+			value["label"] = s_labels[i % s_numLabels];
+			value["value"] = ssValue.str();
+			value["units"] = "C";
+			message["values"].append(value);
+		}
+		for(int i = 0; i < rooms_; ++i) {
+			std::stringstream ssName;
+			ssName << "Room " << i + 1;
+			Json::Value room;
+			room["Name"] = ssName.str();
+			room["currentSetpoint"] = 20.5;
+			room["currentTemp"] = "19.8";
+			message["rooms"].append(room);
+		}
+		message["athome"] = true;
+		return message;
+	}
+
+	long long NowNs() {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	}
+
+	//-----------------------------------------------------------------------------
+	// <Run>
+	// serialize value_ iterations_ times in each encoding and print the size
+	// of one message and the average time per serialization
+	//-----------------------------------------------------------------------------
+	void Run(char const* name_, Json::Value const& value_, int iterations_) {
+		for(int e = 0; e < OZWSS::NumEncodings; ++e) {
+			OZWSS::Encoding const encoding = (OZWSS::Encoding)e;
+			size_t const bytes = OZWSS::Serialize(value_, encoding).size();
+			size_t sink = 0;
+			long long const start = NowNs();
+			for(int i = 0; i < iterations_; ++i) {
+				sink += OZWSS::Serialize(value_, encoding).size();
+			}
+			long long const elapsed = NowNs() - start;
+			printf("%-10s %-5s %8zu bytes %10.0f ns/op%s\n", name_, OZWSS::EncodingName(encoding), bytes,
+				(double)elapsed / iterations_, sink == bytes * iterations_ ? "" : " (size mismatch)");
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+	if(iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+	Run("ALIST", MakeAList(20), iterations);
+	Run("CHANGES", MakeChanges(8, 2), iterations);
+	Run("CHANGES/1", MakeChanges(1, 0), iterations);
+	return 0;
+}
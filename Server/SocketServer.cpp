@@ -0,0 +1,425 @@
+#include "SocketServer.h"
+
+#include <iostream>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace OZWSS {
+	namespace {
+		// epoll data of the eventfd and the listeners, connections count up from FirstConnection
+		const uint64_t WakeId = 0;
+		const uint64_t FirstListener = 1;
+		const uint64_t FirstConnection = 1024;
+
+		// commands a client may have queued before we stop reading from it
+		const size_t MaxQueuedCommands = 64;
+		// output a client may have queued before we stop running its commands
+		const size_t MaxQueuedOutput = 1048576;
+		// a longer line is not a command, the client is disconnected
+		const size_t MaxCommandLength = 65536;
+
+		const size_t ReadSize = 16384;
+	}
+
+	SocketServer::SocketServer(Callbacks const& callbacks_) : m_callbacks(callbacks_), m_nextId(FirstConnection),
+		m_open(0), m_accepted(0), m_commands(0), m_bytesIn(0), m_bytesOut(0) {
+		pthread_mutex_init(&m_replyLock, NULL);
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		m_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u64 = WakeId;
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wake, &event);
+	}
+
+	SocketServer::~SocketServer() {
+		while(!m_connections.empty()) {
+			Drop(m_connections.begin()->first);
+		}
+		for(std::vector<Listener>::iterator it = m_listeners.begin(); it != m_listeners.end(); ++it) {
+			close(it->fd);
+			if(!it->path.empty()) {
+				unlink(it->path.c_str());
+			}
+		}
+		close(m_wake);
+		close(m_epoll);
+		pthread_mutex_destroy(&m_replyLock);
+	}
+
+	bool SocketServer::Listen(std::string const& host_, std::string const& port_) {
+		struct addrinfo hints, *result;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		int error = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &result);
+		if(error != 0) {
+			std::cerr << "Unable to resolve " << host_ << ":" << port_ << ": " << gai_strerror(error) << std::endl;
+			return false;
+		}
+		int fd = socket(result->ai_family, result->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, result->ai_protocol);
+		int reuse = 1;
+		if(fd < 0
+			|| setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0
+			|| bind(fd, result->ai_addr, result->ai_addrlen) < 0
+			|| listen(fd, SOMAXCONN) < 0) {
+			std::cerr << "Unable to listen on " << host_ << ":" << port_ << ": " << strerror(errno) << std::endl;
+			if(fd >= 0) {
+				close(fd);
+			}
+			freeaddrinfo(result);
+			return false;
+		}
+		freeaddrinfo(result);
+		AddListener(fd, "");
+		return true;
+	}
+
+	bool SocketServer::ListenUnix(std::string const& path_, mode_t mode_) {
+		struct sockaddr_un address;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if(path_.empty() || path_.length() >= sizeof(address.sun_path)) {
+			std::cerr << "Invalid unix socket path " << path_ << std::endl;
+			return false;
+		}
+		strncpy(address.sun_path, path_.c_str(), sizeof(address.sun_path) - 1);
+
+		std::string::size_type slash = path_.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+		struct stat info;
+		if(stat(directory.c_str(), &info) != 0 || (info.st_mode & S_IWOTH)) {
+			std::cerr << "Unable to listen on " << path_ << ": " << directory << " is missing or writable by everyone, use a directory of the server" << std::endl;
+			return false;
+		}
+		if(lstat(path_.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+			// only replace the socket if nobody answers on it
+			int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			bool used = probe >= 0 && connect(probe, (struct sockaddr*) &address, sizeof(address)) == 0;
+			if(probe >= 0) {
+				close(probe);
+			}
+			if(used) {
+				std::cerr << "Unable to listen on " << path_ << ": another server is listening on it" << std::endl;
+				return false;
+			}
+			unlink(path_.c_str());
+		}
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		bool bound = fd >= 0 && bind(fd, (struct sockaddr*) &address, sizeof(address)) == 0;
+		// the socket is created with the umask, set the mode clients need to connect
+		if(!bound
+			|| chmod(path_.c_str(), mode_) < 0
+			|| listen(fd, SOMAXCONN) < 0) {
+			std::cerr << "Unable to listen on " << path_ << ": " << strerror(errno) << std::endl;
+			if(bound) {
+				unlink(path_.c_str());
+			}
+			if(fd >= 0) {
+				close(fd);
+			}
+			return false;
+		}
+		AddListener(fd, path_);
+		return true;
+	}
+
+	void SocketServer::AddListener(int fd, std::string const& path) {
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.u64 = FirstListener + m_listeners.size();
+		epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event);
+		Listener listener;
+		listener.fd = fd;
+		listener.path = path;
+		m_listeners.push_back(listener);
+	}
+
+	void SocketServer::Run(volatile bool const& stopping_, std::string const& goodbye_) {
+		struct epoll_event events[64];
+		while(!stopping_) {
+			// wake up now and then to notice stopping_
+			int n = epoll_wait(m_epoll, events, 64, 250);
+			if(n < 0 && errno != EINTR) {
+				std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+				break;
+			}
+			for(int i = 0; i < n; ++i) {
+				uint64_t id = events[i].data.u64;
+				if(id == WakeId) {
+					uint64_t count;
+					while(read(m_wake, &count, sizeof(count)) > 0) {}
+					continue;
+				}
+				if(id < FirstConnection) {
+					Accept(m_listeners[id - FirstListener]);
+					continue;
+				}
+				std::map<uint64_t, Connection*>::iterator it = m_connections.find(id);
+				if(it == m_connections.end()) {
+					continue;
+				}
+				Connection* connection = it->second;
+				if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+					Read(id, connection);
+				}
+				if(events[i].events & EPOLLOUT) {
+					Write(connection);
+				}
+				Service(id);
+			}
+			TakeReplies();
+			// everything that was answered in this round goes out in one write per connection
+			std::set<uint64_t> touched;
+			touched.swap(m_touched);
+			for(std::set<uint64_t>::iterator it = touched.begin(); it != touched.end(); ++it) {
+				Flush(*it);
+			}
+		}
+
+		for(std::map<uint64_t, Connection*>::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+			it->second->output += goodbye_;
+			Write(it->second);
+		}
+	}
+
+	void SocketServer::Reply(uint64_t connection_, std::string const& response_) {
+		pthread_mutex_lock(&m_replyLock);
+		m_replies.push_back(std::make_pair(connection_, response_));
+		pthread_mutex_unlock(&m_replyLock);
+		uint64_t one = 1;
+		if(write(m_wake, &one, sizeof(one)) < 0) {
+			// the counter is full, epoll_wait is woken up anyway
+		}
+	}
+
+	void SocketServer::Accept(Listener const& listener) {
+		while(true) {
+			int fd = accept4(listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if(fd < 0) {
+				if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					std::cerr << "accept failed: " << strerror(errno) << std::endl;
+				}
+				return;
+			}
+			uint64_t id = m_nextId++;
+			Connection* connection = new Connection();
+			connection->fd = fd;
+			connection->events = EPOLLIN;
+			connection->busy = false;
+			connection->eof = false;
+			connection->failed = false;
+			connection->registered = true;
+			connection->scanned = 0;
+
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = connection->events;
+			event.data.u64 = id;
+			if(epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+				close(fd);
+				delete connection;
+				continue;
+			}
+			Peer peer;
+			peer.local = !listener.path.empty();
+			peer.pid = 0;
+			peer.uid = (uid_t) -1;
+			peer.gid = (gid_t) -1;
+			if(peer.local) {
+				// the credentials of the process that connected, checked by the kernel
+				struct ucred credentials;
+				socklen_t length = sizeof(credentials);
+				if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+					peer.pid = credentials.pid;
+					peer.uid = credentials.uid;
+					peer.gid = credentials.gid;
+				}
+			}
+			connection->user = m_callbacks.opened(id, peer);
+			m_connections[id] = connection;
+			++m_open;
+			++m_accepted;
+		}
+	}
+
+	void SocketServer::Read(uint64_t id, Connection* connection) {
+		char buffer[ReadSize];
+		while(Readable(connection)) {
+			ssize_t n = recv(connection->fd, buffer, sizeof(buffer), 0);
+			if(n > 0) {
+				m_bytesIn += n;
+				connection->input.append(buffer, n);
+				SplitCommands(id, connection);
+			}
+			else if(n == 0) {
+				connection->eof = true;
+				SplitCommands(id, connection);
+			}
+			else if(errno == EINTR) {
+				continue;
+			}
+			else {
+				if(errno != EAGAIN && errno != EWOULDBLOCK) {
+					connection->failed = true;
+				}
+				return;
+			}
+		}
+	}
+
+	// Commands end with a newline, a carriage return before it is dropped.
+	// What is left when the client stops sending counts as a command too.
+	void SocketServer::SplitCommands(uint64_t id, Connection* connection) {
+		while(!connection->failed && connection->commands.size() < MaxQueuedCommands) {
+			size_t end = connection->input.find('\n', connection->scanned);
+			if(end == std::string::npos) {
+				connection->scanned = connection->input.size();
+				if(connection->input.size() > MaxCommandLength) {
+					std::cerr << "Socket connection " << id << " sent a command of more than " << MaxCommandLength << " bytes, disconnecting" << std::endl;
+					connection->failed = true;
+					return;
+				}
+				if(connection->eof && !connection->input.empty()) {
+					connection->commands.push_back(connection->input);
+					connection->input.clear();
+					connection->scanned = 0;
+				}
+				return;
+			}
+			size_t length = (end > 0 && connection->input[end - 1] == '\r') ? end - 1 : end;
+			if(length > 0) {
+				connection->commands.push_back(connection->input.substr(0, length));
+			}
+			connection->input.erase(0, end + 1);
+			connection->scanned = 0;
+		}
+	}
+
+	// Stop reading when enough commands are waiting, the client has to wait for their responses
+	bool SocketServer::Readable(Connection const* connection) const {
+		return !connection->eof && !connection->failed && connection->commands.size() < MaxQueuedCommands && connection->input.size() <= MaxCommandLength;
+	}
+
+	void SocketServer::Write(Connection* connection) {
+		size_t written = 0;
+		while(!connection->failed && written < connection->output.size()) {
+			ssize_t n = send(connection->fd, connection->output.data() + written, connection->output.size() - written, MSG_NOSIGNAL);
+			if(n >= 0) {
+				written += n;
+			}
+			else if(errno == EINTR) {
+				continue;
+			}
+			else {
+				if(errno != EAGAIN && errno != EWOULDBLOCK) {
+					connection->failed = true;
+				}
+				break;
+			}
+		}
+		m_bytesOut += written;
+		connection->output.erase(0, written);
+	}
+
+	// Hand over the next command, the response is written by Flush
+	void SocketServer::Service(uint64_t id) {
+		Connection* connection = m_connections[id];
+		if(connection->commands.size() < MaxQueuedCommands) {
+			SplitCommands(id, connection);
+		}
+		if(!connection->failed && !connection->busy && !connection->commands.empty() && connection->output.size() < MaxQueuedOutput) {
+			std::string command = connection->commands.front();
+			connection->commands.pop_front();
+			connection->busy = true;
+			++m_commands;
+			m_callbacks.received(id, connection->user, command);
+		}
+		m_touched.insert(id);
+	}
+
+	// Write what is queued and decide what to wait for
+	void SocketServer::Flush(uint64_t id) {
+		std::map<uint64_t, Connection*>::iterator it = m_connections.find(id);
+		if(it == m_connections.end()) {
+			return;
+		}
+		Connection* connection = it->second;
+		if(!connection->output.empty()) {
+			Write(connection);
+		}
+
+		bool done = connection->failed || (connection->eof && connection->commands.empty() && connection->output.empty());
+		if(done && !connection->busy) {
+			Drop(id);
+			return;
+		}
+		if(connection->failed) {
+			// epoll keeps reporting the error, wait for the handler without it
+			if(connection->registered) {
+				epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+				connection->registered = false;
+			}
+			return;
+		}
+
+		uint32_t events = 0;
+		if(Readable(connection)) {
+			events |= EPOLLIN;
+		}
+		if(!connection->output.empty()) {
+			events |= EPOLLOUT;
+		}
+		if(events != connection->events) {
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = events;
+			event.data.u64 = id;
+			epoll_ctl(m_epoll, EPOLL_CTL_MOD, connection->fd, &event);
+			connection->events = events;
+		}
+	}
+
+	void SocketServer::Drop(uint64_t id) {
+		std::map<uint64_t, Connection*>::iterator it = m_connections.find(id);
+		Connection* connection = it->second;
+		m_connections.erase(it);
+		if(connection->registered) {
+			epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection->fd, NULL);
+		}
+		close(connection->fd);
+		m_callbacks.closed(id, connection->user);
+		delete connection;
+		--m_open;
+	}
+
+	void SocketServer::TakeReplies() {
+		std::vector<std::pair<uint64_t, std::string> > replies;
+		pthread_mutex_lock(&m_replyLock);
+		replies.swap(m_replies);
+		pthread_mutex_unlock(&m_replyLock);
+		for(std::vector<std::pair<uint64_t, std::string> >::iterator it = replies.begin(); it != replies.end(); ++it) {
+			std::map<uint64_t, Connection*>::iterator cit = m_connections.find(it->first);
+			if(cit == m_connections.end()) {
+				continue;
+			}
+			cit->second->busy = false;
+			if(!cit->second->failed) {
+				cit->second->output += it->second;
+			}
+			Service(it->first);
+		}
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef OZWSS_SOCKETSERVER_H_
+#define OZWSS_SOCKETSERVER_H_
+
+#include <atomic>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+namespace OZWSS {
+	// Event driven front end for the command protocol on plain sockets.
+	// One thread waits in epoll for all clients, with non-blocking sockets,
+	// and hands every command to the handler. Commands are lines, a client
+	// may send many of them without waiting for the responses.
+	// The handler answers with Reply, from any thread. A connection has at
+	// most one command at the handler, so its responses go out in the order
+	// its commands came in. Responses that are ready in the same round of
+	// the event loop are written together.
+	// Clients connect over TCP or over a unix socket, for the latter the
+	// handler learns who is on the other end.
+	class SocketServer {
+		public:
+			struct Peer {
+				bool		local;		// connected through a unix socket
+				pid_t		pid;		// of the client process when local, 0 if unknown
+				uid_t		uid;		// -1 if unknown
+				gid_t		gid;
+			};
+
+			// Called on the thread that runs the server, they must not block
+			struct Callbacks {
+				// a client connected, returns the state the handler keeps for it
+				void* (*opened)(uint64_t connection_, Peer const& peer_);
+				// a command came in, the handler answers it with Reply exactly once
+				void (*received)(uint64_t connection_, void* user_, std::string const& data_);
+				// the client is gone and none of its commands is at the handler
+				void (*closed)(uint64_t connection_, void* user_);
+			};
+
+			SocketServer(Callbacks const& callbacks_);
+			// Closes the connections that are left
+			~SocketServer();
+
+			bool Listen(std::string const& host_, std::string const& port_);
+			// Listen on a unix stream socket with file mode mode_. Its directory
+			// must not be writable by everyone, or anybody could take the path.
+			// A socket file left behind by a server that did not stop cleanly is
+			// replaced. Removed again at the end.
+			bool ListenUnix(std::string const& path_, mode_t mode_);
+			// Serve clients until stopping_ is set, then send goodbye_ to all of them
+			void Run(volatile bool const& stopping_, std::string const& goodbye_);
+			// The response to the command handed to the handler last
+			void Reply(uint64_t connection_, std::string const& response_);
+
+			uint64_t Connections() const { return m_open; }
+			uint64_t Accepted() const { return m_accepted; }
+			uint64_t Commands() const { return m_commands; }
+			uint64_t BytesIn() const { return m_bytesIn; }
+			uint64_t BytesOut() const { return m_bytesOut; }
+
+		private:
+			struct Connection {
+				int						fd;
+				void*					user;
+				uint32_t				events;		// registered with epoll
+				std::string				input;		// read, not split into commands yet
+				size_t					scanned;	// input without a newline
+				std::deque<std::string>	commands;	// waiting for the handler
+				std::string				output;		// waiting for the socket
+				bool					busy;		// a command is at the handler
+				bool					eof;		// the client sends no more
+				bool					failed;		// the socket is unusable
+				bool					registered;	// with epoll
+			};
+
+			struct Listener {
+				int						fd;
+				std::string				path;		// of a unix socket, empty for TCP
+			};
+
+			void AddListener(int fd, std::string const& path);
+			void Accept(Listener const& listener);
+			void Read(uint64_t id, Connection* connection);
+			void SplitCommands(uint64_t id, Connection* connection);
+			bool Readable(Connection const* connection) const;
+			void Write(Connection* connection);
+			void Service(uint64_t id);
+			void Flush(uint64_t id);
+			void Drop(uint64_t id);
+			void TakeReplies();
+
+			SocketServer(SocketServer const&);
+			SocketServer& operator=(SocketServer const&);
+
+			Callbacks									m_callbacks;
+			int											m_epoll;
+			int											m_wake;		// eventfd, Reply wakes up epoll_wait with it
+			std::vector<Listener>						m_listeners;
+			std::map<uint64_t, Connection*>				m_connections;
+			std::set<uint64_t>							m_touched;	// to flush at the end of the round
+			uint64_t									m_nextId;
+			pthread_mutex_t								m_replyLock;
+			std::vector<std::pair<uint64_t, std::string> >	m_replies;
+			std::atomic<uint64_t>						m_open;
+			std::atomic<uint64_t>						m_accepted;
+			std::atomic<uint64_t>						m_commands;
+			std::atomic<uint64_t>						m_bytesIn;
+			std::atomic<uint64_t>						m_bytesOut;
+	};
+}
+
+#endif /* OZWSS_SOCKETSERVER_H_ */
@@ -0,0 +1,47 @@
+#ifndef OZWSS_TOKENBUCKET_H_
+#define OZWSS_TOKENBUCKET_H_
+
+#include <stdint.h>
+
+namespace OZWSS {
+	// Limits how often something may happen: on average rate_ times per
+	// second, with bursts of up to burst_ times. A rate of 0 does not limit.
+	// A cost above the burst takes the full bucket, so it is delayed but
+	// never refused for good.
+	// Times are in milliseconds. Not thread safe, callers hold a lock.
+	class TokenBucket {
+		public:
+			TokenBucket(double rate_, double burst_) : m_rate(rate_), m_burst(burst_), m_tokens(burst_), m_updated(0) {}
+
+			// Take cost_ tokens at now. Returns 0 when they were taken, otherwise
+			// the time until there are enough of them; nothing is taken then.
+			uint64_t Take(double cost_, uint64_t now) {
+				if(m_rate <= 0) {
+					return 0;
+				}
+				if(m_updated != 0 && now > m_updated) {
+					m_tokens += (now - m_updated) * m_rate / 1000;
+					if(m_tokens > m_burst) {
+						m_tokens = m_burst;
+					}
+				}
+				m_updated = now;
+				if(cost_ > m_burst) {
+					cost_ = m_burst;
+				}
+				if(m_tokens >= cost_) {
+					m_tokens -= cost_;
+					return 0;
+				}
+				return (uint64_t) ((cost_ - m_tokens) * 1000 / m_rate) + 1;
+			}
+
+		private:
+			double		m_rate;		// tokens per second
+			double		m_burst;
+			double		m_tokens;
+			uint64_t	m_updated;	// time of the last Take
+	};
+}
+
+#endif /* OZWSS_TOKENBUCKET_H_ */
@@ -0,0 +1,140 @@
+#include "ValueStore.h"
+
+#include <algorithm>
+
+namespace OZWSS {
+	using OpenZWave::ValueID;
+
+	bool ValueInfo::AsFloat(float &value_) const {
+		if(!m_valid) {
+			return false;
+		}
+		switch(m_id.GetType()) {
+			case ValueID::ValueType_Bool:
+				value_ = m_bool ? 1.0f : 0.0f;
+				return true;
+			case ValueID::ValueType_Byte:
+				value_ = m_byte;
+				return true;
+			case ValueID::ValueType_Short:
+				value_ = m_short;
+				return true;
+			case ValueID::ValueType_Int:
+			case ValueID::ValueType_List:
+				value_ = (float) m_int;
+				return true;
+			case ValueID::ValueType_Decimal:
+				value_ = m_float;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	bool ValueInfo::AsInt(int32 &value_) const {
+		if(!m_valid) {
+			return false;
+		}
+		switch(m_id.GetType()) {
+			case ValueID::ValueType_Bool:
+				value_ = m_bool ? 1 : 0;
+				return true;
+			case ValueID::ValueType_Byte:
+				value_ = m_byte;
+				return true;
+			case ValueID::ValueType_Short:
+				value_ = m_short;
+				return true;
+			case ValueID::ValueType_Int:
+			case ValueID::ValueType_List:
+				value_ = m_int;
+				return true;
+			case ValueID::ValueType_Decimal:
+				value_ = (int32) m_float;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	uint64 ValueStore::ClassKey(uint8 cmdclass, uint8 instance, uint8 index) {
+		return ((uint64) cmdclass << 16) | ((uint64) instance << 8) | index;
+	}
+
+	ValueStore::Index::iterator ValueStore::LowerBound(Index& index, uint64 key) {
+		return std::lower_bound(index.begin(), index.end(), std::make_pair(key, (uint16) 0));
+	}
+
+	ValueInfo* ValueStore::Add(ValueID const& id, std::string const& label) {
+		if(ValueInfo* existing = Find(id)) {
+			existing->m_label = label;
+			return existing;
+		}
+		uint16 slot = (uint16) m_values.size();
+		m_values.push_back(ValueInfo(id, label));
+		m_byId.insert(LowerBound(m_byId, id.GetId()), std::make_pair(id.GetId(), slot));
+		uint64 classKey = ClassKey(id.GetCommandClassId(), id.GetInstance(), id.GetIndex());
+		m_byClass.insert(LowerBound(m_byClass, classKey), std::make_pair(classKey, slot));
+		return &m_values.back();
+	}
+
+	bool ValueStore::Remove(ValueID const& id) {
+		Index::iterator it = LowerBound(m_byId, id.GetId());
+		if(it == m_byId.end() || it->first != id.GetId()) {
+			return false;
+		}
+		// Removals are rare, keep the insertion order and rebuild the indexes
+		m_values.erase(m_values.begin() + it->second);
+		Reindex();
+		return true;
+	}
+
+	ValueInfo* ValueStore::Find(ValueID const& id) {
+		Index::iterator it = LowerBound(m_byId, id.GetId());
+		if(it == m_byId.end() || it->first != id.GetId()) {
+			return NULL;
+		}
+		return &m_values[it->second];
+	}
+
+	ValueInfo* ValueStore::Find(uint8 cmdclass, uint8 instance, uint8 index) {
+		uint64 key = ClassKey(cmdclass, instance, index);
+		Index::iterator it = LowerBound(m_byClass, key);
+		if(it == m_byClass.end() || it->first != key) {
+			return NULL;
+		}
+		return &m_values[it->second];
+	}
+
+	std::vector<ValueInfo*> ValueStore::FindAll(uint8 cmdclass) {
+		std::vector<ValueInfo*> found;
+		uint64 last = ClassKey(cmdclass, 0xFF, 0xFF);
+		for(Index::iterator it = LowerBound(m_byClass, ClassKey(cmdclass, 0, 0)); it != m_byClass.end() && it->first <= last; ++it) {
+			found.push_back(&m_values[it->second]);
+		}
+		return found;
+	}
+
+	std::vector<ValueInfo*> ValueStore::FindAll(uint8 cmdclass, std::string const& label) {
+		std::vector<ValueInfo*> found;
+		uint64 last = ClassKey(cmdclass, 0xFF, 0xFF);
+		for(Index::iterator it = LowerBound(m_byClass, ClassKey(cmdclass, 0, 0)); it != m_byClass.end() && it->first <= last; ++it) {
+			if(m_values[it->second].m_label == label) {
+				found.push_back(&m_values[it->second]);
+			}
+		}
+		return found;
+	}
+
+	void ValueStore::Reindex() {
+		m_byId.clear();
+		m_byClass.clear();
+		for(uint16 slot = 0; slot < m_values.size(); ++slot) {
+			ValueID const& id = m_values[slot].m_id;
+			m_byId.push_back(std::make_pair(id.GetId(), slot));
+			m_byClass.push_back(std::make_pair(ClassKey(id.GetCommandClassId(), id.GetInstance(), id.GetIndex()), slot));
+		}
+		std::sort(m_byId.begin(), m_byId.end());
+		std::sort(m_byClass.begin(), m_byClass.end());
+	}
+}
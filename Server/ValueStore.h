@@ -0,0 +1,70 @@
+#ifndef OZWSS_VALUESTORE_H_
+#define OZWSS_VALUESTORE_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "ValueID.h"
+
+namespace OZWSS {
+	// One value of a node, together with the last known state the Manager
+	// reported for it, so readers do not have to ask the Manager again
+	struct ValueInfo {
+		OpenZWave::ValueID	m_id;
+		std::string			m_label;
+		std::string			m_units;
+		std::string			m_string;
+		bool				m_valid;
+		uint8				m_tag;
+		union {
+			bool			m_bool;
+			uint8			m_byte;
+			int16			m_short;
+			int32			m_int;
+			float			m_float;
+		};
+
+		ValueInfo(OpenZWave::ValueID const& id, std::string const& label) : m_id(id), m_label(label), m_valid(false), m_tag(0), m_int(0) {}
+		bool AsFloat(float &value_) const;
+		bool AsInt(int32 &value_) const;
+	};
+
+	// The values of a node, stored contiguously in the order they were added.
+	// Lookups by ValueID or by (command class, instance, index) go through
+	// sorted indexes, so a value change never has to allocate.
+	// Not thread safe, callers hold a lock (g_criticalSection in Main.cpp).
+	// Add and Remove move the values: ValueInfo pointers and iterators are
+	// only valid while that lock is held, copy the ValueID to keep a value.
+	class ValueStore {
+		public:
+			typedef std::vector<ValueInfo>::iterator iterator;
+			typedef std::vector<ValueInfo>::const_iterator const_iterator;
+
+			ValueInfo* Add(OpenZWave::ValueID const& id, std::string const& label);
+			bool Remove(OpenZWave::ValueID const& id);
+			ValueInfo* Find(OpenZWave::ValueID const& id);
+			ValueInfo* Find(uint8 cmdclass, uint8 instance, uint8 index);
+			std::vector<ValueInfo*> FindAll(uint8 cmdclass);
+			std::vector<ValueInfo*> FindAll(uint8 cmdclass, std::string const& label);
+
+			iterator begin() { return m_values.begin(); }
+			iterator end() { return m_values.end(); }
+			const_iterator begin() const { return m_values.begin(); }
+			const_iterator end() const { return m_values.end(); }
+			size_t size() const { return m_values.size(); }
+			bool empty() const { return m_values.empty(); }
+
+		private:
+			typedef std::vector< std::pair<uint64, uint16> > Index;
+
+			static uint64 ClassKey(uint8 cmdclass, uint8 instance, uint8 index);
+			static Index::iterator LowerBound(Index& index, uint64 key);
+			void Reindex();
+
+			std::vector<ValueInfo>	m_values;
+			Index					m_byId;
+			Index					m_byClass;
+	};
+}
+#endif // OZWSS_VALUESTORE_H_
@@ -1,6 +1,13 @@
 #!/bin/bash
+# use the unix socket of the server when it has one, set OZWSS_SOCKET to the
+# unix_socket of Config.ini when it is not the one below
+SOCKET=${OZWSS_SOCKET:-/run/openzwave-server/server.sock}
+if [ -S "$SOCKET" ] && command -v socat > /dev/null; then
+	echo "CRON" | socat -t 30 - UNIX-CONNECT:"$SOCKET" | head -n1 > /dev/null
+	exit
+fi
 exec {fd}<>"/dev/tcp/localhost/60004"
 echo "CRON" >&$fd
 head -n1 <&$fd > /dev/null
 exec {fd}>&-
-exec {fd}<&-
\ No newline at end of file
+exec {fd}<&-